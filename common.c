@@ -24,6 +24,7 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +34,19 @@
 
 #include "common.h"
 
+volatile sig_atomic_t done = 0;
+
+static void handle_signal(int signum)
+{
+	done = 1;
+}
+
+void install_signal_handlers(void)
+{
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+}
+
 #define PNG_COLOR_TYPE_INVALID 0xff
 
 png_byte png_format(GLenum format)
@@ -67,11 +81,12 @@ int gles_parse_command_line(struct gles_options *opts, int argc, char *argv[])
 {
 	static const struct option options[] = {
 		{ "size", 1, NULL, 's' },
+		{ "partial", 0, NULL, 'p' },
 		{ NULL, 0, NULL, 0 }
 	};
 	int opt, num;
 
-	while ((opt = getopt_long(argc, argv, "s:", options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "s:p", options, NULL)) != -1) {
 		switch (opt) {
 		case 's':
 			num = sscanf(optarg, "%ux%u", &opts->width,
@@ -82,6 +97,10 @@ int gles_parse_command_line(struct gles_options *opts, int argc, char *argv[])
 			}
 
 			break;
+
+		case 'p':
+			opts->partial = true;
+			break;
 		}
 	}
 
@@ -364,6 +383,68 @@ void glsl_program_link(GLuint program)
 	}
 }
 
+struct framebuffer *framebuffer_create(unsigned int width, unsigned int height,
+				       GLenum format)
+{
+	struct framebuffer *framebuffer;
+	GLenum status;
+
+	framebuffer = calloc(1, sizeof(*framebuffer));
+	if (!framebuffer)
+		return NULL;
+
+	framebuffer->width = width;
+	framebuffer->height = height;
+	framebuffer->format = format;
+
+	glGenTextures(1, &framebuffer->texture);
+	glBindTexture(GL_TEXTURE_2D, framebuffer->texture);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
+		     GL_UNSIGNED_BYTE, NULL);
+
+	glGenFramebuffers(1, &framebuffer->id);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer->id);
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, framebuffer->texture, 0);
+
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "framebuffer incomplete: %x\n", status);
+		framebuffer_free(framebuffer);
+		return NULL;
+	}
+
+	return framebuffer;
+}
+
+void framebuffer_free(struct framebuffer *framebuffer)
+{
+	if (framebuffer) {
+		glDeleteFramebuffers(1, &framebuffer->id);
+		glDeleteTextures(1, &framebuffer->texture);
+	}
+
+	free(framebuffer);
+}
+
+/* binds the framebuffer, or the window surface if framebuffer is NULL */
+void framebuffer_bind(struct framebuffer *framebuffer)
+{
+	if (framebuffer)
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer->id);
+	else
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
 enum image_format {
 	IMAGE_FORMAT_RGB888,
 	IMAGE_FORMAT_RGBA8888,
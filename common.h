@@ -26,18 +26,26 @@
 #ifndef GBM_TESTS_COMMON_H
 #define GBM_TESTS_COMMON_H 1
 
+#include <signal.h>
 #include <stdbool.h>
 
 #include <gbm.h>
+#include <GLES2/gl2.h>
 #include <EGL/egl.h>
 
 #include "drm-kms.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
+/* set by SIGINT and SIGTERM once install_signal_handlers() was called */
+extern volatile sig_atomic_t done;
+
+void install_signal_handlers(void);
+
 struct gles_options {
 	unsigned int width;
 	unsigned int height;
+	bool partial;
 };
 
 int gles_parse_command_line(struct gles_options *options, int argc,
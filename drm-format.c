@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2026 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+
+#include <drm_fourcc.h>
+#include <gbm.h>
+
+#include "drm-format.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static const struct drm_format drm_formats[] = {
+	{
+		.format = DRM_FORMAT_C8,
+		.gbm_format = GBM_FORMAT_C8,
+		.num_planes = 1,
+		.bpp = { 8 },
+		.hsub = 1,
+		.vsub = 1,
+		.name = "C8",
+	}, {
+		.format = DRM_FORMAT_RGB565,
+		.gbm_format = GBM_FORMAT_RGB565,
+		.num_planes = 1,
+		.bpp = { 16 },
+		.hsub = 1,
+		.vsub = 1,
+		.name = "RGB565",
+	}, {
+		.format = DRM_FORMAT_RGB888,
+		.gbm_format = GBM_FORMAT_RGB888,
+		.num_planes = 1,
+		.bpp = { 24 },
+		.hsub = 1,
+		.vsub = 1,
+		.name = "RGB888",
+	}, {
+		.format = DRM_FORMAT_XRGB8888,
+		.gbm_format = GBM_FORMAT_XRGB8888,
+		.num_planes = 1,
+		.bpp = { 32 },
+		.hsub = 1,
+		.vsub = 1,
+		.name = "XRGB8888",
+	}, {
+		.format = DRM_FORMAT_ARGB8888,
+		.gbm_format = GBM_FORMAT_ARGB8888,
+		.num_planes = 1,
+		.bpp = { 32 },
+		.hsub = 1,
+		.vsub = 1,
+		.name = "ARGB8888",
+	}, {
+		.format = DRM_FORMAT_XRGB2101010,
+		.gbm_format = GBM_FORMAT_XRGB2101010,
+		.num_planes = 1,
+		.bpp = { 32 },
+		.hsub = 1,
+		.vsub = 1,
+		.name = "XRGB2101010",
+	}, {
+		.format = DRM_FORMAT_ARGB2101010,
+		.gbm_format = GBM_FORMAT_ARGB2101010,
+		.num_planes = 1,
+		.bpp = { 32 },
+		.hsub = 1,
+		.vsub = 1,
+		.name = "ARGB2101010",
+	}, {
+		.format = DRM_FORMAT_XBGR16161616F,
+		.gbm_format = GBM_FORMAT_XBGR16161616F,
+		.num_planes = 1,
+		.bpp = { 64 },
+		.hsub = 1,
+		.vsub = 1,
+		.name = "XBGR16161616F",
+	}, {
+		.format = DRM_FORMAT_ABGR16161616F,
+		.gbm_format = GBM_FORMAT_ABGR16161616F,
+		.num_planes = 1,
+		.bpp = { 64 },
+		.hsub = 1,
+		.vsub = 1,
+		.name = "ABGR16161616F",
+	}, {
+		.format = DRM_FORMAT_NV12,
+		.gbm_format = GBM_FORMAT_NV12,
+		.num_planes = 2,
+		.bpp = { 8, 16 },
+		.hsub = 2,
+		.vsub = 2,
+		.name = "NV12",
+	}, {
+		.format = DRM_FORMAT_P010,
+		.gbm_format = 0,
+		.num_planes = 2,
+		.bpp = { 16, 32 },
+		.hsub = 2,
+		.vsub = 2,
+		.name = "P010",
+	}, {
+		.format = DRM_FORMAT_YUV420,
+		.gbm_format = 0,
+		.num_planes = 3,
+		.bpp = { 8, 8, 8 },
+		.hsub = 2,
+		.vsub = 2,
+		.name = "YUV420",
+	},
+};
+
+const struct drm_format *drm_format_find(uint32_t format)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(drm_formats); i++)
+		if (drm_formats[i].format == format)
+			return &drm_formats[i];
+
+	return NULL;
+}
+
+const char *drm_format_name(char *buffer, uint32_t format)
+{
+	buffer[0] = (format >>  0) & 0xff;
+	buffer[1] = (format >>  8) & 0xff;
+	buffer[2] = (format >> 16) & 0xff;
+	buffer[3] = (format >> 24) & 0xff;
+	buffer[4] = '\0';
+
+	return buffer;
+}
+
+/* minimum pitch of a plane, in bytes */
+uint64_t drm_format_plane_pitch(const struct drm_format *format,
+				unsigned int plane, unsigned int width)
+{
+	if (plane > 0)
+		width = (width + format->hsub - 1) / format->hsub;
+
+	return ((uint64_t)width * format->bpp[plane] + 7) / 8;
+}
+
+uint64_t drm_format_plane_size(const struct drm_format *format,
+			       unsigned int plane, unsigned int width,
+			       unsigned int height)
+{
+	if (plane > 0)
+		height = (height + format->vsub - 1) / format->vsub;
+
+	return drm_format_plane_pitch(format, plane, width) * height;
+}
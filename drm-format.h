@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DRM_FORMAT_H
+#define DRM_FORMAT_H 1
+
+#include <stdint.h>
+
+#define DRM_FORMAT_MAX_PLANES 4
+
+/*
+ * Describes the memory layout of a DRM pixel format. Subsampled planes are
+ * hsub (vsub) times narrower (shorter) than the first plane.
+ */
+struct drm_format {
+	uint32_t format;
+	uint32_t gbm_format; /* 0 if GBM can't allocate the format */
+	unsigned int num_planes;
+	unsigned int bpp[DRM_FORMAT_MAX_PLANES];
+	unsigned int hsub;
+	unsigned int vsub;
+	const char *name;
+};
+
+const struct drm_format *drm_format_find(uint32_t format);
+const char *drm_format_name(char *buffer, uint32_t format);
+
+uint64_t drm_format_plane_pitch(const struct drm_format *format,
+				unsigned int plane, unsigned int width);
+uint64_t drm_format_plane_size(const struct drm_format *format,
+			       unsigned int plane, unsigned int width,
+			       unsigned int height);
+
+#endif /* DRM_FORMAT_H */
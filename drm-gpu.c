@@ -25,29 +25,103 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <drm_fourcc.h>
 #include <xf86drm.h>
 
+#include <GLES2/gl2.h>
+
+#include "drm-format.h"
 #include "drm-gpu.h"
 
-static int drm_gpu_init(struct drm_gpu *gpu)
+/* checks whether a space-separated list of extensions contains one */
+static bool drm_gpu_find_extension(const char *extensions, const char *name)
+{
+	size_t length = strlen(name);
+	const char *end;
+
+	if (!extensions)
+		return false;
+
+	end = extensions + strlen(extensions);
+
+	while (extensions < end) {
+		size_t n = strcspn(extensions, " ");
+
+		if (n == length && strncmp(extensions, name, n) == 0)
+			return true;
+
+		extensions += n + 1;
+	}
+
+	return false;
+}
+
+static bool drm_gpu_has_extension(struct drm_gpu *gpu, const char *name)
 {
-	static const EGLint config_attribs[] = {
+	return drm_gpu_find_extension(eglQueryString(gpu->egl.display,
+						     EGL_EXTENSIONS), name);
+}
+
+/*
+ * Fences are exported as sync_file FDs, which requires native fence sync,
+ * and waited for on the GPU, which requires wait sync.
+ */
+static void drm_gpu_init_sync(struct drm_gpu *gpu)
+{
+	if (!drm_gpu_has_extension(gpu, "EGL_ANDROID_native_fence_sync") ||
+	    !drm_gpu_has_extension(gpu, "EGL_KHR_wait_sync"))
+		return;
+
+	gpu->sync.create = (void *)eglGetProcAddress("eglCreateSyncKHR");
+	gpu->sync.destroy = (void *)eglGetProcAddress("eglDestroySyncKHR");
+	gpu->sync.wait = (void *)eglGetProcAddress("eglWaitSyncKHR");
+	gpu->sync.dup = (void *)eglGetProcAddress("eglDupNativeFenceFDANDROID");
+
+	if (!gpu->sync.create || !gpu->sync.destroy || !gpu->sync.wait ||
+	    !gpu->sync.dup)
+		memset(&gpu->sync, 0, sizeof(gpu->sync));
+}
+
+static int drm_gpu_create_context(struct drm_gpu *gpu, unsigned int version)
+{
+	const EGLint config_attribs[] = {
 		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
 		EGL_RED_SIZE, 1,
 		EGL_GREEN_SIZE, 1,
 		EGL_BLUE_SIZE, 1,
 		EGL_ALPHA_SIZE, 0,
-		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_RENDERABLE_TYPE, version >= 3 ? EGL_OPENGL_ES3_BIT_KHR :
+						    EGL_OPENGL_ES2_BIT,
 		EGL_NONE
 	};
-	static const EGLint context_attribs[] = {
-		EGL_CONTEXT_CLIENT_VERSION, 2,
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, version,
 		EGL_NONE
 	};
-	EGLint major, minor, count;
+	EGLint count;
+
+	if (!eglChooseConfig(gpu->egl.display, config_attribs,
+			     &gpu->egl.config, 1, &count) ||
+	    count != 1)
+		return -ENOENT;
+
+	gpu->egl.context = eglCreateContext(gpu->egl.display, gpu->egl.config,
+					    EGL_NO_CONTEXT, context_attribs);
+	if (gpu->egl.context == EGL_NO_CONTEXT)
+		return -EINVAL;
+
+	gpu->gles = version;
+
+	return 0;
+}
+
+static int drm_gpu_init(struct drm_gpu *gpu)
+{
+	EGLint major, minor;
+	int err;
 
 	gpu->egl.display = eglGetDisplay(gpu->device);
 	if (gpu->egl.display == EGL_NO_DISPLAY) {
@@ -70,20 +144,29 @@ static int drm_gpu_init(struct drm_gpu *gpu)
 		return -EINVAL;
 	}
 
-	if (!eglChooseConfig(gpu->egl.display, config_attribs,
-			     &gpu->egl.config, 1, &count) ||
-	    count != 1) {
-		fprintf(stderr, "failed to choose EGL configuration\n");
-		return -EINVAL;
-	}
+	/* OpenGL ES 3 is preferred for glInvalidateFramebuffer() */
+	err = drm_gpu_create_context(gpu, 3);
+	if (err < 0)
+		err = drm_gpu_create_context(gpu, 2);
 
-	gpu->egl.context = eglCreateContext(gpu->egl.display, gpu->egl.config,
-					    EGL_NO_CONTEXT, context_attribs);
-	if (gpu->egl.context == EGL_NO_CONTEXT) {
-		fprintf(stderr, "failed to create EGL context\n");
-		return -EINVAL;
+	if (err < 0) {
+		fprintf(stderr, "failed to create EGL context: %d\n", err);
+		return err;
 	}
 
+	printf("OpenGL ES %u context\n", gpu->gles);
+
+	drm_gpu_init_sync(gpu);
+
+	gpu->buffer_age = drm_gpu_has_extension(gpu, "EGL_EXT_buffer_age");
+
+	if (drm_gpu_has_extension(gpu, "EGL_KHR_swap_buffers_with_damage"))
+		gpu->swap_buffers_with_damage =
+			(void *)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	else if (drm_gpu_has_extension(gpu, "EGL_EXT_swap_buffers_with_damage"))
+		gpu->swap_buffers_with_damage =
+			(void *)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+
 	return 0;
 }
 
@@ -153,58 +236,202 @@ void drm_gpu_bind_surface(struct drm_gpu *gpu, struct drm_gpu_surface *surface)
 		       surface->egl.surface, gpu->egl.context);
 }
 
-static inline const char *drm_format_name(char *buffer, uint32_t format)
+/*
+ * Tells the driver that the given buffers of the bound framebuffer don't
+ * need to be kept, so that tiled renderers can skip loading them into or
+ * storing them from tile memory. The context must be current.
+ */
+void drm_gpu_invalidate(struct drm_gpu *gpu, unsigned int buffers)
 {
-	buffer[0] = (format >>  0) & 0xff;
-	buffer[1] = (format >>  8) & 0xff;
-	buffer[2] = (format >> 16) & 0xff;
-	buffer[3] = (format >> 24) & 0xff;
-	buffer[4] = '\0';
+	const char *extensions;
+	GLenum attachments[3];
+	GLsizei count = 0;
+	GLint fbo = 0;
+
+	if (!gpu->invalidate_checked) {
+		extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+		if (gpu->gles >= 3)
+			gpu->invalidate_framebuffer =
+				(void *)eglGetProcAddress("glInvalidateFramebuffer");
+		else if (drm_gpu_find_extension(extensions,
+						"GL_EXT_discard_framebuffer"))
+			gpu->invalidate_framebuffer =
+				(void *)eglGetProcAddress("glDiscardFramebufferEXT");
+
+		gpu->invalidate_checked = true;
+	}
+
+	if (!gpu->invalidate_framebuffer)
+		return;
 
-	return buffer;
+	/* the window framebuffer uses different names for its buffers */
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+
+	if (buffers & DRM_GPU_COLOR)
+		attachments[count++] = fbo ? GL_COLOR_ATTACHMENT0 : GL_COLOR_EXT;
+
+	if (buffers & DRM_GPU_DEPTH)
+		attachments[count++] = fbo ? GL_DEPTH_ATTACHMENT : GL_DEPTH_EXT;
+
+	if (buffers & DRM_GPU_STENCIL)
+		attachments[count++] = fbo ? GL_STENCIL_ATTACHMENT :
+					     GL_STENCIL_EXT;
+
+	if (count > 0)
+		gpu->invalidate_framebuffer(GL_FRAMEBUFFER, count, attachments);
 }
 
-int drm_gpu_surface_create(struct drm_gpu_surface **surfacep,
-			   struct drm_gpu *gpu, unsigned int width,
-			   unsigned int height, uint32_t format,
-			   unsigned long flags)
+bool drm_gpu_has_fences(struct drm_gpu *gpu)
+{
+	return gpu->sync.create != NULL;
+}
+
+/*
+ * Returns a sync_file that signals once the GPU has finished all rendering
+ * submitted so far. The caller owns the returned file descriptor.
+ */
+int drm_gpu_create_fence(struct drm_gpu *gpu, int *fencep)
+{
+	static const EGLint attribs[] = {
+		EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
+		EGL_NONE
+	};
+	EGLSyncKHR sync;
+	int fence;
+
+	if (!drm_gpu_has_fences(gpu))
+		return -EOPNOTSUPP;
+
+	sync = gpu->sync.create(gpu->egl.display, EGL_SYNC_NATIVE_FENCE_ANDROID,
+				attribs);
+	if (sync == EGL_NO_SYNC_KHR)
+		return -ENOMEM;
+
+	/* the fence only gets a file descriptor once it has been flushed */
+	glFlush();
+
+	fence = gpu->sync.dup(gpu->egl.display, sync);
+	gpu->sync.destroy(gpu->egl.display, sync);
+
+	if (fence == EGL_NO_NATIVE_FENCE_FD_ANDROID)
+		return -EINVAL;
+
+	*fencep = fence;
+
+	return 0;
+}
+
+/*
+ * Makes the GPU wait for a sync_file to signal before executing any further
+ * commands, without blocking the caller. Takes ownership of the fence.
+ */
+int drm_gpu_wait_fence(struct drm_gpu *gpu, int fence)
+{
+	const EGLint attribs[] = {
+		EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fence,
+		EGL_NONE
+	};
+	EGLSyncKHR sync;
+
+	if (!drm_gpu_has_fences(gpu)) {
+		close(fence);
+		return -EOPNOTSUPP;
+	}
+
+	/* on success, EGL owns the file descriptor */
+	sync = gpu->sync.create(gpu->egl.display, EGL_SYNC_NATIVE_FENCE_ANDROID,
+				attribs);
+	if (sync == EGL_NO_SYNC_KHR) {
+		close(fence);
+		return -EINVAL;
+	}
+
+	gpu->sync.wait(gpu->egl.display, sync, 0);
+	gpu->sync.destroy(gpu->egl.display, sync);
+
+	return 0;
+}
+
+/*
+ * Creates a surface whose buffers use one of the given modifiers. If only
+ * the linear modifier is given, or the GBM implementation can't allocate
+ * with any of them, the surface falls back to the driver's default layout.
+ * Modifiers that need more memory planes than a buffer can describe are
+ * skipped.
+ */
+int drm_gpu_surface_create_with_modifiers(struct drm_gpu_surface **surfacep,
+					  struct drm_gpu *gpu,
+					  unsigned int width,
+					  unsigned int height,
+					  uint32_t format,
+					  const uint64_t *modifiers,
+					  unsigned int count,
+					  unsigned long flags)
 {
 	uint32_t gbm_format, gbm_flags = 0;
+	const struct drm_format *info;
 	struct drm_gpu_surface *surface;
+	unsigned int num = 0, i;
+	uint64_t *supported;
 	char name[5];
 
-	switch (format) {
-	case DRM_FORMAT_XRGB8888:
-		gbm_format = GBM_FORMAT_XRGB8888;
-		break;
-
-	case DRM_FORMAT_ARGB8888:
-		gbm_format = GBM_FORMAT_ARGB8888;
-		break;
-
-	default:
+	info = drm_format_find(format);
+	if (!info || !info->gbm_format) {
 		fprintf(stderr, "unsupported format: %s\n",
 			drm_format_name(name, format));
 		return -EINVAL;
 	}
 
+	gbm_format = info->gbm_format;
+
 	if (flags & DRM_GPU_SCANOUT)
 		gbm_flags |= GBM_BO_USE_SCANOUT;
 
 	if (flags & DRM_GPU_RENDER)
 		gbm_flags |= GBM_BO_USE_RENDERING;
 
+	supported = calloc(count ?: 1, sizeof(*supported));
+	if (!supported)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		int planes;
+
+		planes = gbm_device_get_format_modifier_plane_count(gpu->device,
+								    gbm_format,
+								    modifiers[i]);
+		if (planes > 0 && planes <= DRM_GPU_MAX_PLANES)
+			supported[num++] = modifiers[i];
+	}
+
 	surface = calloc(1, sizeof(*surface));
-	if (!surface)
+	if (!surface) {
+		free(supported);
 		return -ENOMEM;
+	}
 
 	surface->gpu = gpu;
 	surface->width = width;
 	surface->height = height;
 	surface->format = format;
 
-	surface->gbm.surface = gbm_surface_create(gpu->device, width, height,
-						  gbm_format, gbm_flags);
+	if (num > 1 || (num == 1 && supported[0] != DRM_FORMAT_MOD_LINEAR)) {
+		surface->gbm.surface =
+			gbm_surface_create_with_modifiers(gpu->device, width,
+							  height, gbm_format,
+							  supported, num);
+		if (!surface->gbm.surface)
+			fprintf(stderr, "failed to create GBM surface with modifiers, using default layout\n");
+	}
+
+	free(supported);
+
+	if (!surface->gbm.surface)
+		surface->gbm.surface = gbm_surface_create(gpu->device, width,
+							  height, gbm_format,
+							  gbm_flags);
+
 	if (!surface->gbm.surface) {
 		fprintf(stderr, "failed to create GBM surface\n");
 		free(surface);
@@ -222,43 +449,254 @@ int drm_gpu_surface_create(struct drm_gpu_surface **surfacep,
 		return -EINVAL;
 	}
 
+	/*
+	 * Preserving the contents across swaps would require the driver to
+	 * copy or reload them. Use the buffer age to redraw only parts.
+	 */
+	eglSurfaceAttrib(gpu->egl.display, surface->egl.surface,
+			 EGL_SWAP_BEHAVIOR, EGL_BUFFER_DESTROYED);
+
 	*surfacep = surface;
 
 	return 0;
 }
 
+int drm_gpu_surface_create(struct drm_gpu_surface **surfacep,
+			   struct drm_gpu *gpu, unsigned int width,
+			   unsigned int height, uint32_t format,
+			   unsigned long flags)
+{
+	return drm_gpu_surface_create_with_modifiers(surfacep, gpu, width,
+						     height, format, NULL, 0,
+						     flags);
+}
+
 void drm_gpu_surface_free(struct drm_gpu_surface *surface)
 {
+	struct drm_gpu *gpu = surface->gpu;
+
+	if (eglGetCurrentSurface(EGL_DRAW) == surface->egl.surface)
+		eglMakeCurrent(gpu->egl.display, EGL_NO_SURFACE,
+			       EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+	/* this destroys all buffers and with them their wrappers */
+	eglDestroySurface(gpu->egl.display, surface->egl.surface);
+	gbm_surface_destroy(surface->gbm.surface);
 	free(surface);
 }
 
-int drm_gpu_surface_lock(struct drm_gpu_surface *surface,
-			 struct drm_gpu_buffer **bop)
+static void drm_gpu_rect_union(struct drm_gpu_rect *rect,
+			       const struct drm_gpu_rect *other)
+{
+	int x1 = rect->x + rect->width, y1 = rect->y + rect->height;
+	int x2 = other->x + other->width, y2 = other->y + other->height;
+
+	if (other->width == 0 || other->height == 0)
+		return;
+
+	if (rect->width == 0 || rect->height == 0) {
+		*rect = *other;
+		return;
+	}
+
+	if (other->x < rect->x)
+		rect->x = other->x;
+
+	if (other->y < rect->y)
+		rect->y = other->y;
+
+	rect->width = (x2 > x1 ? x2 : x1) - rect->x;
+	rect->height = (y2 > y1 ? y2 : y1) - rect->y;
+}
+
+/*
+ * Starts a frame that changes the damage rectangle of the surface, or all of
+ * it if damage is NULL. Returns in redraw the region that needs to be drawn
+ * for the back buffer to be up to date: the damage of this frame and of all
+ * frames since the back buffer was last drawn, as told by its buffer age. If
+ * that is less than the whole surface, rendering is scissored to it.
+ *
+ * The surface must be bound.
+ */
+int drm_gpu_surface_begin(struct drm_gpu_surface *surface,
+			  const struct drm_gpu_rect *damage,
+			  struct drm_gpu_rect *redraw)
+{
+	struct drm_gpu *gpu = surface->gpu;
+	struct drm_gpu_rect full;
+	EGLint age = 0;
+	unsigned int i;
+
+	full.x = 0;
+	full.y = 0;
+	full.width = surface->width;
+	full.height = surface->height;
+
+	surface->damage.current = damage ? *damage : full;
+	*redraw = surface->damage.current;
+
+	/* an age of 0 means that the contents of the buffer are undefined */
+	if (gpu->buffer_age &&
+	    !eglQuerySurface(gpu->egl.display, surface->egl.surface,
+			     EGL_BUFFER_AGE_EXT, &age))
+		age = 0;
+
+	if (age <= 0 || (unsigned int)age - 1 > surface->damage.count) {
+		*redraw = full;
+	} else {
+		for (i = 0; i < (unsigned int)age - 1; i++)
+			drm_gpu_rect_union(redraw, &surface->damage.history[i]);
+	}
+
+	if (redraw->width < full.width || redraw->height < full.height) {
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(redraw->x, redraw->y, redraw->width, redraw->height);
+	} else {
+		/* everything is redrawn, so the old contents needn't be loaded */
+		glDisable(GL_SCISSOR_TEST);
+		drm_gpu_invalidate(gpu, DRM_GPU_COLOR | DRM_GPU_DEPTH |
+				   DRM_GPU_STENCIL);
+	}
+
+	return 0;
+}
+
+/*
+ * Presents the frame started with drm_gpu_surface_begin(), telling the
+ * compositor or display which part of it changed if possible.
+ */
+int drm_gpu_surface_swap(struct drm_gpu_surface *surface)
+{
+	struct drm_gpu_rect *current = &surface->damage.current;
+	struct drm_gpu *gpu = surface->gpu;
+	EGLBoolean ret;
+	EGLint rect[4];
+	GLint fbo = 0;
+
+	glDisable(GL_SCISSOR_TEST);
+
+	/* depth and stencil are never presented, so don't write them back */
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+	if (fbo == 0)
+		drm_gpu_invalidate(gpu, DRM_GPU_DEPTH | DRM_GPU_STENCIL);
+
+	memmove(&surface->damage.history[1], &surface->damage.history[0],
+		(DRM_GPU_DAMAGE_HISTORY - 1) * sizeof(*current));
+	surface->damage.history[0] = *current;
+
+	if (surface->damage.count < DRM_GPU_DAMAGE_HISTORY)
+		surface->damage.count++;
+
+	if (gpu->swap_buffers_with_damage) {
+		rect[0] = current->x;
+		rect[1] = current->y;
+		rect[2] = current->width;
+		rect[3] = current->height;
+
+		ret = gpu->swap_buffers_with_damage(gpu->egl.display,
+						    surface->egl.surface,
+						    rect, 1);
+	} else {
+		ret = eglSwapBuffers(gpu->egl.display, surface->egl.surface);
+	}
+
+	if (!ret)
+		return -EIO;
+
+	return 0;
+}
+
+static void drm_gpu_buffer_destroy(struct gbm_bo *gbm_bo, void *data)
+{
+	struct drm_gpu_buffer *bo = data;
+	struct drm_gpu_surface *surface = bo->surface;
+	unsigned int i;
+
+	if (surface->destroy)
+		surface->destroy(bo, surface->destroy_data);
+
+	drm_map_release(&bo->map);
+
+	for (i = 0; i < bo->num_planes; i++)
+		close(bo->planes[i].fd);
+
+	free(bo);
+}
+
+static struct drm_gpu_buffer *
+drm_gpu_buffer_create(struct drm_gpu_surface *surface, struct gbm_bo *gbm_bo)
 {
 	struct drm_gpu_buffer *bo;
+	unsigned int i, count;
 	uint32_t handle;
 	int err;
 
+	count = gbm_bo_get_plane_count(gbm_bo);
+	if (count < 1 || count > DRM_GPU_MAX_PLANES)
+		return NULL;
+
 	bo = calloc(1, sizeof(*bo));
 	if (!bo)
-		return -ENOMEM;
+		return NULL;
 
-	bo->bo = gbm_surface_lock_front_buffer(surface->gbm.surface);
-	if (!bo->bo) {
-		free(bo);
-		return -EINVAL;
-	}
+	for (i = 0; i < count; i++) {
+		handle = gbm_bo_get_handle_for_plane(gbm_bo, i).u32;
 
-	handle = gbm_bo_get_handle(bo->bo).u32;
+		/* read-write so that linear buffers can be mapped for writing */
+		err = drmPrimeHandleToFD(surface->gpu->fd, handle,
+					 DRM_CLOEXEC | DRM_RDWR,
+					 &bo->planes[i].fd);
+		if (err < 0) {
+			while (i--)
+				close(bo->planes[i].fd);
 
-	err = drmPrimeHandleToFD(surface->gpu->fd, handle, 0, &bo->fd);
-	if (err < 0)
-		return -errno;
+			free(bo);
+			return NULL;
+		}
+
+		bo->planes[i].offset = gbm_bo_get_offset(gbm_bo, i);
+		bo->planes[i].stride = gbm_bo_get_stride_for_plane(gbm_bo, i);
+	}
 
-	bo->width = gbm_bo_get_width(bo->bo);
-	bo->height = gbm_bo_get_height(bo->bo);
-	bo->stride = gbm_bo_get_stride(bo->bo);
+	bo->surface = surface;
+	bo->bo = gbm_bo;
+	bo->width = gbm_bo_get_width(gbm_bo);
+	bo->height = gbm_bo_get_height(gbm_bo);
 	bo->format = surface->format;
+	bo->modifier = gbm_bo_get_modifier(gbm_bo);
+	bo->num_planes = count;
+
+	if (bo->modifier == DRM_FORMAT_MOD_LINEAR && count == 1)
+		drm_map_init_dmabuf(&bo->map, bo->planes[0].fd, bo->width,
+				    bo->height, bo->planes[0].stride,
+				    bo->planes[0].offset);
+	else
+		drm_map_init_gbm(&bo->map, gbm_bo);
+
+	gbm_bo_set_user_data(gbm_bo, bo, drm_gpu_buffer_destroy);
+
+	return bo;
+}
+
+int drm_gpu_surface_lock(struct drm_gpu_surface *surface,
+			 struct drm_gpu_buffer **bop)
+{
+	struct drm_gpu_buffer *bo;
+	struct gbm_bo *gbm_bo;
+
+	gbm_bo = gbm_surface_lock_front_buffer(surface->gbm.surface);
+	if (!gbm_bo)
+		return -EINVAL;
+
+	bo = gbm_bo_get_user_data(gbm_bo);
+	if (!bo) {
+		bo = drm_gpu_buffer_create(surface, gbm_bo);
+		if (!bo) {
+			gbm_surface_release_buffer(surface->gbm.surface,
+						   gbm_bo);
+			return -ENOMEM;
+		}
+	}
 
 	*bop = bo;
 
@@ -267,30 +705,22 @@ int drm_gpu_surface_lock(struct drm_gpu_surface *surface,
 
 void drm_gpu_surface_unlock(struct drm_gpu_surface *surface, struct drm_gpu_buffer *bo)
 {
-	close(bo->fd);
 	gbm_surface_release_buffer(surface->gbm.surface, bo->bo);
 }
 
-int drm_gpu_buffer_map(struct drm_gpu_buffer *bo, void **ptrp,
-		       uint32_t *stridep)
+/*
+ * Linear buffers are accessed through a long-lived mapping of their DMA-BUF.
+ * Other layouts need the GBM implementation to (de)tile them on each access.
+ * The flags select the access (DRM_MAP_READ, DRM_MAP_WRITE or both) so that
+ * no more data is transferred than needed.
+ */
+int drm_gpu_buffer_map(struct drm_gpu_buffer *bo, unsigned int flags,
+		       void **ptrp, uint32_t *stridep)
 {
-	uint32_t stride;
-
-	bo->ptr = gbm_bo_map(bo->bo, 0, 0, bo->width, bo->height,
-			     GBM_BO_TRANSFER_READ_WRITE, &stride,
-			     &bo->map_data);
-	if (!bo->ptr)
-		return -ENOMEM;
-
-	*stridep = stride;
-	*ptrp = bo->ptr;
-
-	return 0;
+	return drm_map_begin(&bo->map, flags, 0, 0, ptrp, stridep);
 }
 
 void drm_gpu_buffer_unmap(struct drm_gpu_buffer *bo)
 {
-	gbm_bo_unmap(bo->bo, bo->map_data);
-	bo->map_data = NULL;
-	bo->ptr = NULL;
+	drm_map_end(&bo->map);
 }
@@ -24,28 +24,62 @@
 #ifndef DRM_GPU_H
 #define DRM_GPU_H 1
 
+#include <stdbool.h>
+
 #include <gbm.h>
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "drm-map.h"
 
 #define DRM_GPU_SCANOUT (1 << 0)
 #define DRM_GPU_RENDER  (1 << 1)
 
+#define DRM_GPU_MAX_PLANES 4
+
+struct drm_gpu_surface;
+
+/* GL window coordinates, the origin is at the bottom left */
+struct drm_gpu_rect {
+	int x;
+	int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+/* number of previous frames whose damage is remembered */
+#define DRM_GPU_DAMAGE_HISTORY 4
+
+/*
+ * Buffers are created the first time GBM hands out a BO and live for as long
+ * as the BO does, so locking a surface doesn't allocate or export anything.
+ */
 struct drm_gpu_buffer {
+	struct drm_gpu_surface *surface;
 	struct gbm_bo *bo;
 
-	int fd;
 	unsigned int width;
 	unsigned int height;
-	unsigned int stride;
 	uint32_t format;
+	uint64_t modifier;
+
+	/* memory planes, compressed layouts add auxiliary ones */
+	struct {
+		int fd; /* DMA-BUF */
+		unsigned int offset;
+		unsigned int stride;
+	} planes[DRM_GPU_MAX_PLANES];
+	unsigned int num_planes;
 
-	void *map_data;
-	void *ptr;
+	struct drm_map map;
 };
 
-int drm_gpu_buffer_map(struct drm_gpu_buffer *bo, void **ptrp,
-		       uint32_t *stridep);
+int drm_gpu_buffer_map(struct drm_gpu_buffer *bo, unsigned int flags,
+		       void **ptrp, uint32_t *stridep);
 void drm_gpu_buffer_unmap(struct drm_gpu_buffer *bo);
 
 struct drm_gpu_surface {
@@ -61,17 +95,52 @@ struct drm_gpu_surface {
 	struct {
 		EGLSurface surface;
 	} egl;
+
+	/*
+	 * Called before a buffer of the surface is destroyed. This may happen
+	 * while the buffer is still being scanned out, so users need to flip
+	 * away from it, or close the screen, before freeing the surface.
+	 */
+	void (*destroy)(struct drm_gpu_buffer *bo, void *data);
+	void *destroy_data;
+
+	/* damage of the current frame and of previous ones, newest first */
+	struct {
+		struct drm_gpu_rect current;
+		struct drm_gpu_rect history[DRM_GPU_DAMAGE_HISTORY];
+		unsigned int count;
+	} damage;
 };
 
 struct drm_gpu {
 	struct gbm_device *device;
 	int fd;
+	unsigned int gles; /* OpenGL ES version of the context */
 
 	struct {
 		EGLDisplay display;
 		EGLConfig config;
 		EGLContext context;
 	} egl;
+
+	/* EGL_ANDROID_native_fence_sync, all NULL if not supported */
+	struct {
+		PFNEGLCREATESYNCKHRPROC create;
+		PFNEGLDESTROYSYNCKHRPROC destroy;
+		PFNEGLWAITSYNCKHRPROC wait;
+		PFNEGLDUPNATIVEFENCEFDANDROIDPROC dup;
+	} sync;
+
+	/* EGL_EXT_buffer_age and EGL_{KHR,EXT}_swap_buffers_with_damage */
+	bool buffer_age;
+	PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_buffers_with_damage;
+
+	/*
+	 * glInvalidateFramebuffer() or glDiscardFramebufferEXT(), which take
+	 * the same arguments. Looked up once the context is first current.
+	 */
+	PFNGLDISCARDFRAMEBUFFEREXTPROC invalidate_framebuffer;
+	bool invalidate_checked;
 };
 
 int drm_gpu_create(struct drm_gpu **gpup, int fd);
@@ -82,11 +151,33 @@ void drm_gpu_close(struct drm_gpu *gpu);
 
 void drm_gpu_bind_surface(struct drm_gpu *gpu, struct drm_gpu_surface *surface);
 
+#define DRM_GPU_COLOR   (1 << 0)
+#define DRM_GPU_DEPTH   (1 << 1)
+#define DRM_GPU_STENCIL (1 << 2)
+
+void drm_gpu_invalidate(struct drm_gpu *gpu, unsigned int buffers);
+
+bool drm_gpu_has_fences(struct drm_gpu *gpu);
+int drm_gpu_create_fence(struct drm_gpu *gpu, int *fencep);
+int drm_gpu_wait_fence(struct drm_gpu *gpu, int fence);
+
 int drm_gpu_surface_create(struct drm_gpu_surface **surfacep,
 			   struct drm_gpu *gpu, unsigned int width,
 			   unsigned int height, uint32_t format,
 			   unsigned long flags);
+int drm_gpu_surface_create_with_modifiers(struct drm_gpu_surface **surfacep,
+					  struct drm_gpu *gpu,
+					  unsigned int width,
+					  unsigned int height,
+					  uint32_t format,
+					  const uint64_t *modifiers,
+					  unsigned int count,
+					  unsigned long flags);
 void drm_gpu_surface_free(struct drm_gpu_surface *surface);
+int drm_gpu_surface_begin(struct drm_gpu_surface *surface,
+			  const struct drm_gpu_rect *damage,
+			  struct drm_gpu_rect *redraw);
+int drm_gpu_surface_swap(struct drm_gpu_surface *surface);
 
 int drm_gpu_surface_lock(struct drm_gpu_surface *surface,
 			 struct drm_gpu_buffer **bop);
@@ -21,16 +21,45 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdbool.h>
 #include <stdio.h>
-#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <drm_fourcc.h>
 #include <xf86drm.h>
 
+#include "drm-format.h"
 #include "drm-kms.h"
+#include "drm-pixel.h"
+
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP 0x15
+#endif
+
+static uint64_t drm_kms_get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* returns the duration of a refresh cycle in nanoseconds */
+static uint64_t drm_kms_mode_get_period(const drmModeModeInfo *mode)
+{
+	if (mode->clock == 0)
+		return 0;
+
+	return (uint64_t)mode->htotal * mode->vtotal * 1000000 / mode->clock;
+}
 
 int drm_kms_bo_create(struct drm_kms_bo **bop, int fd, unsigned int width,
 		      unsigned int height, unsigned int bpp)
@@ -60,6 +89,9 @@ int drm_kms_bo_create(struct drm_kms_bo **bop, int fd, unsigned int width,
 	bo->pitch = arg.pitch;
 	bo->fd = fd;
 
+	drm_map_init_dumb(&bo->map, fd, bo->handle, width, height, bo->pitch,
+			  bo->size);
+
 	*bop = bo;
 
 	return 0;
@@ -70,10 +102,7 @@ int drm_kms_bo_free(struct drm_kms_bo *bo)
 	struct drm_mode_destroy_dumb arg;
 	int err;
 
-	if (bo->ptr) {
-		munmap(bo->ptr, bo->size);
-		bo->ptr = NULL;
-	}
+	drm_map_release(&bo->map);
 
 	memset(&arg, 0, sizeof(arg));
 	arg.handle = bo->handle;
@@ -87,37 +116,122 @@ int drm_kms_bo_free(struct drm_kms_bo *bo)
 	return 0;
 }
 
+/*
+ * The mapping is created on first use and kept until the buffer is freed, so
+ * only the first call is expensive.
+ */
 int drm_kms_bo_map(struct drm_kms_bo *bo)
 {
-	struct drm_mode_map_dumb arg;
-	void *map;
-	int err;
+	return drm_map_begin(&bo->map, DRM_MAP_RW, 0, 0, &bo->ptr, NULL);
+}
 
-	if (bo->ptr) {
-		bo->map_count++;
-		return 0;
+int drm_kms_bo_unmap(struct drm_kms_bo *bo)
+{
+	return drm_map_end(&bo->map);
+}
+
+static void drm_kms_surface_clear_fences(struct drm_kms_surface *surface)
+{
+	if (surface->fence >= 0) {
+		close(surface->fence);
+		surface->fence = -1;
 	}
 
-	memset(&arg, 0, sizeof(arg));
-	arg.handle = bo->handle;
+	if (surface->release >= 0) {
+		close(surface->release);
+		surface->release = -1;
+	}
+}
 
-	err = drmIoctl(bo->fd, DRM_IOCTL_MODE_MAP_DUMB, &arg);
-	if (err < 0)
-		return -errno;
+static void drm_kms_surface_clear_damage(struct drm_kms_surface *surface)
+{
+	free(surface->damage.rects);
+	surface->damage.rects = NULL;
+	surface->damage.count = 0;
+}
 
-	map = mmap(0, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED, bo->fd,
-		   arg.offset);
-	if (map == MAP_FAILED)
-		return -errno;
+static void drm_kms_surface_destroy(struct drm_kms_surface *surface)
+{
+	drm_kms_surface_clear_fences(surface);
+	drm_kms_surface_clear_damage(surface);
+	drmModeRmFB(surface->screen->fd, surface->id);
+	free(surface->shadow);
+	drm_kms_bo_free(surface->bo);
+	free(surface);
+}
+
+static struct drm_kms_surface *drm_kms_pool_get(struct drm_kms_pool *pool,
+						unsigned int width,
+						unsigned int height,
+						uint32_t format)
+{
+	struct drm_kms_surface *surface;
+	unsigned int i;
 
-	bo->ptr = map;
+	/* the most recently freed buffers are the most likely to be cached */
+	for (i = pool->num_surfaces; i > 0; i--) {
+		surface = pool->surfaces[i - 1];
 
-	return 0;
+		if (surface->width == width && surface->height == height &&
+		    surface->format == format) {
+			memmove(&pool->surfaces[i - 1], &pool->surfaces[i],
+				(pool->num_surfaces - i) * sizeof(surface));
+			pool->num_surfaces--;
+			pool->size -= surface->bo->size;
+
+			return surface;
+		}
+	}
+
+	return NULL;
 }
 
-int drm_kms_bo_unmap(struct drm_kms_bo *bo)
+/*
+ * Releases the least recently freed surfaces until the pool retains no more
+ * than size bytes.
+ */
+void drm_kms_screen_trim_pool(struct drm_kms_screen *screen, uint64_t size)
+{
+	struct drm_kms_pool *pool = &screen->pool;
+	struct drm_kms_surface *surface;
+
+	while (pool->num_surfaces > 0 && pool->size > size) {
+		surface = pool->surfaces[0];
+
+		memmove(&pool->surfaces[0], &pool->surfaces[1],
+			(pool->num_surfaces - 1) * sizeof(surface));
+		pool->num_surfaces--;
+		pool->size -= surface->bo->size;
+
+		drm_kms_surface_destroy(surface);
+	}
+}
+
+static int drm_kms_pool_put(struct drm_kms_screen *screen,
+			    struct drm_kms_surface *surface)
 {
-	bo->map_count--;
+	struct drm_kms_pool *pool = &screen->pool;
+	struct drm_kms_surface **surfaces;
+
+	if (surface->bo->size > pool->max_size)
+		return -ENOSPC;
+
+	drm_kms_screen_trim_pool(screen, pool->max_size - surface->bo->size);
+
+	surfaces = realloc(pool->surfaces,
+			   (pool->num_surfaces + 1) * sizeof(*surfaces));
+	if (!surfaces)
+		return -ENOMEM;
+
+	surface->freed = false;
+	surface->submitted = 0;
+	surface->data = NULL;
+	drm_kms_surface_clear_fences(surface);
+	drm_kms_surface_clear_damage(surface);
+
+	surfaces[pool->num_surfaces++] = surface;
+	pool->surfaces = surfaces;
+	pool->size += surface->bo->size;
 
 	return 0;
 }
@@ -127,11 +241,28 @@ int drm_kms_surface_create(struct drm_kms_surface **surfacep,
 			   unsigned int width, unsigned int height,
 			   uint32_t format)
 {
+	const struct drm_format *info;
 	struct drm_kms_surface *surface;
 	uint32_t offset = 0;
-	unsigned int bpp;
 	int err;
 
+	/* dumb buffers can only back single-plane formats */
+	info = drm_format_find(format);
+	if (!info || info->num_planes > 1)
+		return -EINVAL;
+
+	if (screen->pool.max_size > 0) {
+		surface = drm_kms_pool_get(&screen->pool, width, height,
+					   format);
+		if (surface) {
+			screen->pool.hits++;
+			*surfacep = surface;
+			return 0;
+		}
+
+		screen->pool.misses++;
+	}
+
 	surface = calloc(1, sizeof(*surface));
 	if (!surface)
 		return -ENOMEM;
@@ -139,22 +270,13 @@ int drm_kms_surface_create(struct drm_kms_surface **surfacep,
 	surface->screen = screen;
 	surface->width = width;
 	surface->height = height;
+	surface->bpp = info->bpp[0];
 	surface->format = format;
+	surface->fence = -1;
+	surface->release = -1;
 
-	switch (format) {
-	case DRM_FORMAT_C8:
-		bpp = 8;
-		break;
-
-	case DRM_FORMAT_XRGB8888:
-		bpp = 32;
-		break;
-
-	default:
-		return -EINVAL;
-	}
-
-	err = drm_kms_bo_create(&surface->bo, screen->fd, width, height, bpp);
+	err = drm_kms_bo_create(&surface->bo, screen->fd, width, height,
+				surface->bpp);
 	if (err < 0) {
 		free(surface);
 		return err;
@@ -169,18 +291,190 @@ int drm_kms_surface_create(struct drm_kms_surface **surfacep,
 		return err;
 	}
 
+	/* dumb buffers start out zeroed, and so does the shadow */
+	if (screen->shadow) {
+		surface->shadow = calloc(1, surface->bo->size);
+		if (!surface->shadow) {
+			drmModeRmFB(screen->fd, surface->id);
+			drm_kms_bo_free(surface->bo);
+			free(surface);
+			return -ENOMEM;
+		}
+	}
+
 	*surfacep = surface;
 
 	return 0;
 }
 
+/*
+ * GEM handles are unique per DRM file, so importing the same DMA-BUF twice
+ * yields the same handle. Keep track of how many framebuffers use each one
+ * so that it's only closed once the last of them is gone.
+ */
+static int drm_kms_screen_get_handle(struct drm_kms_screen *screen, int fd,
+				     uint32_t *handlep)
+{
+	struct drm_kms_handle *handles;
+	uint32_t handle;
+	unsigned int i;
+	int err;
+
+	err = drmPrimeFDToHandle(screen->fd, fd, &handle);
+	if (err < 0)
+		return -errno;
+
+	for (i = 0; i < screen->num_handles; i++) {
+		if (screen->handles[i].handle == handle) {
+			screen->handles[i].refcount++;
+			*handlep = handle;
+			return 0;
+		}
+	}
+
+	handles = realloc(screen->handles,
+			  (screen->num_handles + 1) * sizeof(*handles));
+	if (!handles)
+		return -ENOMEM;
+
+	handles[screen->num_handles].handle = handle;
+	handles[screen->num_handles].refcount = 1;
+	screen->handles = handles;
+	screen->num_handles++;
+
+	*handlep = handle;
+
+	return 0;
+}
+
+static void drm_kms_screen_put_handle(struct drm_kms_screen *screen,
+				      uint32_t handle)
+{
+	struct drm_gem_close args;
+	unsigned int i;
+
+	for (i = 0; i < screen->num_handles; i++)
+		if (screen->handles[i].handle == handle)
+			break;
+
+	if (i == screen->num_handles || --screen->handles[i].refcount > 0)
+		return;
+
+	screen->handles[i] = screen->handles[--screen->num_handles];
+
+	memset(&args, 0, sizeof(args));
+	args.handle = handle;
+
+	drmIoctl(screen->fd, DRM_IOCTL_GEM_CLOSE, &args);
+}
+
+static struct drm_kms_surface *
+drm_kms_screen_find_import(struct drm_kms_screen *screen,
+			   const struct drm_kms_import *args,
+			   const uint32_t *handles, unsigned int num_planes)
+{
+	struct drm_kms_surface *surface;
+	unsigned int i, j;
+
+	for (i = 0; i < screen->num_imports; i++) {
+		surface = screen->imports[i];
+
+		if (surface->width != args->width ||
+		    surface->height != args->height ||
+		    surface->format != args->format ||
+		    surface->modifier != args->planes[0].modifier ||
+		    surface->import.num_planes != num_planes)
+			continue;
+
+		for (j = 0; j < num_planes; j++)
+			if (surface->import.handles[j] != handles[j] ||
+			    surface->import.offsets[j] != args->planes[j].offset ||
+			    surface->import.pitches[j] != args->planes[j].pitch)
+				break;
+
+		if (j == num_planes)
+			return surface;
+	}
+
+	return NULL;
+}
+
+/* removes an imported surface from the cache so it is no longer found */
+static void drm_kms_surface_unlink_import(struct drm_kms_surface *surface)
+{
+	struct drm_kms_screen *screen = surface->screen;
+	unsigned int i;
+
+	for (i = 0; i < screen->num_imports; i++) {
+		if (screen->imports[i] == surface) {
+			screen->imports[i] = screen->imports[--screen->num_imports];
+			break;
+		}
+	}
+}
+
+static void drm_kms_surface_destroy_import(struct drm_kms_surface *surface)
+{
+	struct drm_kms_screen *screen = surface->screen;
+	unsigned int i;
+
+	drm_kms_surface_unlink_import(surface);
+	drm_kms_surface_clear_fences(surface);
+	drm_kms_surface_clear_damage(surface);
+	drmModeRmFB(screen->fd, surface->id);
+
+	for (i = 0; i < surface->import.num_planes; i++)
+		drm_kms_screen_put_handle(screen, surface->import.handles[i]);
+
+	free(surface);
+}
+
+static void drm_kms_surface_release(struct drm_kms_surface *surface)
+{
+	if (!surface->bo) {
+		drm_kms_surface_destroy_import(surface);
+		return;
+	}
+
+	if (surface->screen->pool.max_size > 0 &&
+	    drm_kms_pool_put(surface->screen, surface) == 0)
+		return;
+
+	drm_kms_surface_destroy(surface);
+}
+
+/* marks a surface as no longer used by the display */
+static void drm_kms_surface_set_free(struct drm_kms_surface *surface)
+{
+	surface->state = DRM_KMS_SURFACE_FREE;
+
+	if (surface->freed)
+		drm_kms_surface_release(surface);
+}
+
 int drm_kms_surface_free(struct drm_kms_surface *surface)
 {
 	if (!surface)
 		return -EINVAL;
 
-	drm_kms_bo_free(surface->bo);
-	free(surface);
+	/* imported surfaces don't own a dumb buffer */
+	if (!surface->bo && --surface->import.refcount > 0)
+		return 0;
+
+	/*
+	 * Surfaces that are scanned out or waiting to be can't be reused or
+	 * have their framebuffer removed until a flip replaces them. Imports
+	 * leave the cache right away so that they can't be found again.
+	 */
+	if (surface->state != DRM_KMS_SURFACE_FREE) {
+		if (!surface->bo)
+			drm_kms_surface_unlink_import(surface);
+
+		surface->freed = true;
+		return 0;
+	}
+
+	drm_kms_surface_release(surface);
 
 	return 0;
 }
@@ -192,6 +486,11 @@ int drm_kms_surface_lock(struct drm_kms_surface *surface, void **ptr)
 	if (!surface || !ptr)
 		return -EINVAL;
 
+	if (surface->shadow) {
+		*ptr = surface->shadow;
+		return 0;
+	}
+
 	err = drm_kms_bo_map(surface->bo);
 	if (err < 0)
 		return err;
@@ -201,6 +500,58 @@ int drm_kms_surface_lock(struct drm_kms_surface *surface, void **ptr)
 	return 0;
 }
 
+/*
+ * Copies the shadow to the buffer. If damage was set for the surface before
+ * unlocking, only the damaged rectangles are copied, otherwise all of it.
+ * The copy uses streaming stores, so nothing is ever read back from the
+ * (usually write-combined) buffer.
+ */
+static int drm_kms_surface_flush_shadow(struct drm_kms_surface *surface)
+{
+	struct drm_kms_bo *bo = surface->bo;
+	unsigned int cpp = surface->bpp / 8;
+	unsigned int i, x, y, width, height;
+	uint64_t offset;
+	void *ptr;
+	int err;
+
+	err = drm_map_begin(&bo->map, DRM_MAP_WRITE, 0, 0, &ptr, NULL);
+	if (err < 0)
+		return err;
+
+	if (surface->damage.count == 0)
+		drm_pixel_copy(ptr, surface->shadow, bo->size);
+
+	for (i = 0; i < surface->damage.count; i++) {
+		const struct drm_kms_rect *rect = &surface->damage.rects[i];
+
+		x = rect->x < 0 ? 0 : rect->x;
+		y = rect->y < 0 ? 0 : rect->y;
+
+		if (x >= surface->width || y >= surface->height ||
+		    rect->x + (int)rect->width <= (int)x ||
+		    rect->y + (int)rect->height <= (int)y)
+			continue;
+
+		width = rect->x + rect->width - x;
+		height = rect->y + rect->height - y;
+
+		if (width > surface->width - x)
+			width = surface->width - x;
+
+		if (height > surface->height - y)
+			height = surface->height - y;
+
+		offset = (uint64_t)y * bo->pitch + x * cpp;
+
+		drm_pixel_copy_rect(ptr + offset, bo->pitch,
+				    surface->shadow + offset, bo->pitch,
+				    width * cpp, height);
+	}
+
+	return drm_map_end(&bo->map);
+}
+
 int drm_kms_surface_unlock(struct drm_kms_surface *surface)
 {
 	int err;
@@ -208,6 +559,9 @@ int drm_kms_surface_unlock(struct drm_kms_surface *surface)
 	if (!surface)
 		return -EINVAL;
 
+	if (surface->shadow)
+		return drm_kms_surface_flush_shadow(surface);
+
 	err = drm_kms_bo_unmap(surface->bo);
 	if (err < 0)
 		return err;
@@ -215,6 +569,105 @@ int drm_kms_surface_unlock(struct drm_kms_surface *surface)
 	return 0;
 }
 
+/*
+ * Makes the next flip to the surface wait for the given sync_file to signal.
+ * The surface takes ownership of the file descriptor.
+ */
+void drm_kms_surface_set_fence(struct drm_kms_surface *surface, int fence)
+{
+	if (surface->fence >= 0)
+		close(surface->fence);
+
+	surface->fence = fence;
+}
+
+/*
+ * Returns a sync_file that signals once the display engine has stopped
+ * scanning out of the surface, or -1 if there is none. The caller owns the
+ * returned file descriptor.
+ */
+int drm_kms_surface_take_release(struct drm_kms_surface *surface)
+{
+	int fence = surface->release;
+
+	surface->release = -1;
+
+	return fence;
+}
+
+/*
+ * Restricts the next flip to the surface to the given rectangles, in surface
+ * coordinates. Drivers that copy or compose the framebuffer (virtual, USB or
+ * remote displays) can then skip the parts that didn't change. The contents
+ * outside of the rectangles must match those of the surface currently being
+ * scanned out. Passing no rectangles marks the whole surface as damaged.
+ */
+int drm_kms_surface_set_damage(struct drm_kms_surface *surface,
+			       const struct drm_kms_rect *rects,
+			       unsigned int count)
+{
+	struct drm_kms_rect *damage = NULL;
+
+	if (count > 0) {
+		damage = malloc(count * sizeof(*damage));
+		if (!damage)
+			return -ENOMEM;
+
+		memcpy(damage, rects, count * sizeof(*damage));
+	}
+
+	free(surface->damage.rects);
+	surface->damage.rects = damage;
+	surface->damage.count = count;
+
+	return 0;
+}
+
+/* waits up to timeout milliseconds (-1 for no limit) for a fence to signal */
+int drm_kms_fence_wait(int fence, int timeout)
+{
+	struct pollfd fds;
+	int err;
+
+	memset(&fds, 0, sizeof(fds));
+	fds.fd = fence;
+	fds.events = POLLIN;
+
+	do {
+		err = poll(&fds, 1, timeout);
+	} while (err < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (err < 0)
+		return -errno;
+
+	if (err == 0)
+		return -ETIMEDOUT;
+
+	if (fds.revents & (POLLERR | POLLNVAL))
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Used when the fence can't be handed to the display engine, so that the
+ * flip still doesn't show a partially rendered buffer.
+ */
+static void drm_kms_surface_wait_fence(struct drm_kms_surface *surface)
+{
+	int err;
+
+	if (surface->fence < 0)
+		return;
+
+	err = drm_kms_fence_wait(surface->fence, -1);
+	if (err < 0)
+		fprintf(stderr, "failed to wait for fence: %d\n", err);
+
+	close(surface->fence);
+	surface->fence = -1;
+}
+
 static int drm_kms_screen_choose_output(struct drm_kms_screen *screen)
 {
 	int ret = -ENODEV;
@@ -277,213 +730,2527 @@ static int drm_kms_screen_choose_output(struct drm_kms_screen *screen)
 	return ret;
 }
 
-int drm_kms_screen_create_with_args(struct drm_kms_screen **screenp, int fd,
-				    const struct drm_kms_screen_args *args)
+static int drm_kms_object_find_property(int fd,
+					drmModeObjectPropertiesPtr props,
+					const char *name, uint32_t *idp,
+					uint64_t *valuep)
 {
-	struct drm_kms_screen *screen;
-	unsigned int i;
-	int err;
+	drmModePropertyPtr prop;
+	uint32_t i;
 
-	err = drmSetMaster(fd);
-	if (err < 0)
-		return -errno;
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
 
-	screen = calloc(1, sizeof(*screen));
-	if (!screen)
-		return -ENOMEM;
+		if (strcmp(prop->name, name) == 0) {
+			if (idp)
+				*idp = prop->prop_id;
 
-	screen->fd = fd;
+			if (valuep)
+				*valuep = props->prop_values[i];
 
-	err = drm_kms_screen_choose_output(screen);
-	if (err < 0)
-		return err;
+			drmModeFreeProperty(prop);
+			return 0;
+		}
 
-	screen->original_crtc = drmModeGetCrtc(screen->fd, screen->crtc);
+		drmModeFreeProperty(prop);
+	}
 
-	if (args->flags & DRM_KMS_SCREEN_FULLSCREEN) {
-		screen->width = screen->mode.hdisplay;
-		screen->height = screen->mode.vdisplay;
-	} else {
-		screen->width = args->width;
+	return -ENOENT;
+}
+
+static int drm_kms_screen_find_primary_plane(struct drm_kms_screen *screen)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePlaneResPtr res;
+	drmModePlanePtr plane;
+	int err = -ENODEV;
+	uint64_t type;
+	uint32_t i;
+
+	res = drmModeGetPlaneResources(screen->fd);
+	if (!res)
+		return -errno;
+
+	for (i = 0; i < res->count_planes; i++) {
+		plane = drmModeGetPlane(screen->fd, res->planes[i]);
+		if (!plane)
+			continue;
+
+		if ((plane->possible_crtcs & (1 << screen->pipe)) == 0) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+
+		props = drmModeObjectGetProperties(screen->fd, plane->plane_id,
+						   DRM_MODE_OBJECT_PLANE);
+		if (!props) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+
+		if (drm_kms_object_find_property(screen->fd, props, "type",
+						 NULL, &type) == 0 &&
+		    type == DRM_PLANE_TYPE_PRIMARY) {
+			screen->atomic.plane = plane->plane_id;
+			err = 0;
+		}
+
+		drmModeFreeObjectProperties(props);
+		drmModeFreePlane(plane);
+
+		if (err == 0)
+			break;
+	}
+
+	drmModeFreePlaneResources(res);
+	return err;
+}
+
+/*
+ * Looks up the IDs of the properties needed to program a plane. The zpos,
+ * IN_FENCE_FD and FB_DAMAGE_CLIPS properties are optional and left at 0 if
+ * the plane doesn't have them.
+ */
+static int drm_kms_plane_get_props(int fd, uint32_t plane,
+				   struct drm_kms_plane_props *props)
+{
+	struct {
+		const char *name;
+		uint32_t *id;
+	} names[] = {
+		{ "FB_ID", &props->fb_id },
+		{ "CRTC_ID", &props->crtc_id },
+		{ "SRC_X", &props->src_x },
+		{ "SRC_Y", &props->src_y },
+		{ "SRC_W", &props->src_w },
+		{ "SRC_H", &props->src_h },
+		{ "CRTC_X", &props->crtc_x },
+		{ "CRTC_Y", &props->crtc_y },
+		{ "CRTC_W", &props->crtc_w },
+		{ "CRTC_H", &props->crtc_h },
+	};
+	drmModeObjectPropertiesPtr values;
+	unsigned int i;
+	int err = 0;
+
+	values = drmModeObjectGetProperties(fd, plane, DRM_MODE_OBJECT_PLANE);
+	if (!values)
+		return -errno;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		err = drm_kms_object_find_property(fd, values, names[i].name,
+						   names[i].id, NULL);
+		if (err < 0)
+			break;
+	}
+
+	if (drm_kms_object_find_property(fd, values, "zpos", &props->zpos,
+					 NULL) < 0)
+		props->zpos = 0;
+
+	if (drm_kms_object_find_property(fd, values, "IN_FENCE_FD",
+					 &props->in_fence_fd, NULL) < 0)
+		props->in_fence_fd = 0;
+
+	if (drm_kms_object_find_property(fd, values, "FB_DAMAGE_CLIPS",
+					 &props->fb_damage_clips, NULL) < 0)
+		props->fb_damage_clips = 0;
+
+	drmModeFreeObjectProperties(values);
+
+	return err;
+}
+
+/*
+ * Adds the state for scanning out the src rectangle of a framebuffer to the
+ * dst rectangle of a CRTC. A framebuffer ID of 0 disables the plane.
+ */
+static int drm_kms_atomic_add_plane(drmModeAtomicReqPtr req, uint32_t plane,
+				    const struct drm_kms_plane_props *props,
+				    uint32_t crtc, uint32_t fb,
+				    const struct drm_kms_rect *src,
+				    const struct drm_kms_rect *dst)
+{
+	int err = 0;
+
+	if (fb == 0) {
+		err |= drmModeAtomicAddProperty(req, plane, props->fb_id, 0);
+		err |= drmModeAtomicAddProperty(req, plane, props->crtc_id, 0);
+		return err;
+	}
+
+	err |= drmModeAtomicAddProperty(req, plane, props->fb_id, fb);
+	err |= drmModeAtomicAddProperty(req, plane, props->crtc_id, crtc);
+	err |= drmModeAtomicAddProperty(req, plane, props->src_x,
+					(uint64_t)src->x << 16);
+	err |= drmModeAtomicAddProperty(req, plane, props->src_y,
+					(uint64_t)src->y << 16);
+	err |= drmModeAtomicAddProperty(req, plane, props->src_w,
+					(uint64_t)src->width << 16);
+	err |= drmModeAtomicAddProperty(req, plane, props->src_h,
+					(uint64_t)src->height << 16);
+	err |= drmModeAtomicAddProperty(req, plane, props->crtc_x, dst->x);
+	err |= drmModeAtomicAddProperty(req, plane, props->crtc_y, dst->y);
+	err |= drmModeAtomicAddProperty(req, plane, props->crtc_w,
+					dst->width);
+	err |= drmModeAtomicAddProperty(req, plane, props->crtc_h,
+					dst->height);
+
+	return err;
+}
+
+static int drm_kms_screen_init_atomic(struct drm_kms_screen *screen)
+{
+	drmModeObjectPropertiesPtr props;
+	uint64_t value;
+	int err;
+
+	err = drmSetClientCap(screen->fd, DRM_CLIENT_CAP_ATOMIC, 1);
+	if (err < 0)
+		return -EOPNOTSUPP;
+
+	err = drm_kms_screen_find_primary_plane(screen);
+	if (err < 0)
+		return err;
+
+	props = drmModeObjectGetProperties(screen->fd, screen->crtc,
+					   DRM_MODE_OBJECT_CRTC);
+	if (!props)
+		return -errno;
+
+	err = drm_kms_object_find_property(screen->fd, props, "ACTIVE",
+					   &screen->atomic.crtc.active, NULL);
+	if (err == 0)
+		err = drm_kms_object_find_property(screen->fd, props, "MODE_ID",
+						   &screen->atomic.crtc.mode_id,
+						   NULL);
+
+	/* explicit synchronization is optional */
+	if (drm_kms_object_find_property(screen->fd, props, "OUT_FENCE_PTR",
+					 &screen->atomic.crtc.out_fence_ptr,
+					 NULL) < 0)
+		screen->atomic.crtc.out_fence_ptr = 0;
+
+	drmModeFreeObjectProperties(props);
+
+	if (err < 0)
+		return err;
+
+	props = drmModeObjectGetProperties(screen->fd, screen->connector,
+					   DRM_MODE_OBJECT_CONNECTOR);
+	if (!props)
+		return -errno;
+
+	err = drm_kms_object_find_property(screen->fd, props, "CRTC_ID",
+					   &screen->atomic.connector.crtc_id,
+					   NULL);
+	drmModeFreeObjectProperties(props);
+
+	if (err < 0)
+		return err;
+
+	err = drm_kms_plane_get_props(screen->fd, screen->atomic.plane,
+				      &screen->atomic.primary);
+	if (err < 0)
+		return err;
+
+	if (drmGetCap(screen->fd, DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP, &value) == 0)
+		screen->atomic.async = value != 0;
+
+	err = drmModeCreatePropertyBlob(screen->fd, &screen->mode,
+					sizeof(screen->mode),
+					&screen->atomic.mode);
+	if (err < 0)
+		return -errno;
+
+	screen->atomic.enabled = true;
+
+	return 0;
+}
+
+/*
+ * Adds the state of an output that scans out the given surface at the
+ * output's offset to an atomic request.
+ */
+static int drm_kms_screen_atomic_add_output(struct drm_kms_screen *output,
+					    drmModeAtomicReqPtr req,
+					    struct drm_kms_surface *surface,
+					    uint32_t damage, uint32_t flags)
+{
+	struct drm_kms_rect src, dst;
+	int err = 0;
+
+	/* asynchronous commits may only change the framebuffer */
+	if (flags & DRM_MODE_PAGE_FLIP_ASYNC)
+		return drmModeAtomicAddProperty(req, output->atomic.plane,
+						output->atomic.primary.fb_id,
+						surface->id);
+
+	src.x = output->x;
+	src.y = output->y;
+	src.width = surface->width - output->x;
+	src.height = surface->height - output->y;
+
+	if (src.width > output->mode.hdisplay)
+		src.width = output->mode.hdisplay;
+
+	if (src.height > output->mode.vdisplay)
+		src.height = output->mode.vdisplay;
+
+	dst.x = 0;
+	dst.y = 0;
+
+	/* let the display engine stretch the framebuffer to fill the mode */
+	if (output->render.scaled) {
+		dst.width = output->mode.hdisplay;
+		dst.height = output->mode.vdisplay;
+	} else {
+		dst.width = src.width;
+		dst.height = src.height;
+	}
+
+	if (flags & DRM_MODE_ATOMIC_ALLOW_MODESET) {
+		err |= drmModeAtomicAddProperty(req, output->connector,
+						output->atomic.connector.crtc_id,
+						output->crtc);
+		err |= drmModeAtomicAddProperty(req, output->crtc,
+						output->atomic.crtc.mode_id,
+						output->atomic.mode);
+		err |= drmModeAtomicAddProperty(req, output->crtc,
+						output->atomic.crtc.active, 1);
+	}
+
+	err |= drm_kms_atomic_add_plane(req, output->atomic.plane,
+					&output->atomic.primary, output->crtc,
+					surface->id, &src, &dst);
+
+	if (surface->fence >= 0 && output->atomic.primary.in_fence_fd)
+		err |= drmModeAtomicAddProperty(req, output->atomic.plane,
+						output->atomic.primary.in_fence_fd,
+						surface->fence);
+
+	if (damage)
+		err |= drmModeAtomicAddProperty(req, output->atomic.plane,
+						output->atomic.primary.fb_damage_clips,
+						damage);
+
+	return err;
+}
+
+static bool drm_kms_screen_planes_dirty(struct drm_kms_screen *screen)
+{
+	unsigned int i;
+
+	for (i = 0; i < screen->num_planes; i++)
+		if (screen->planes[i].dirty)
+			return true;
+
+	return false;
+}
+
+/* adds the state of all overlay planes that were changed since the last commit */
+static int drm_kms_screen_atomic_add_planes(struct drm_kms_screen *screen,
+					    drmModeAtomicReqPtr req)
+{
+	struct drm_kms_plane *plane;
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < screen->num_planes; i++) {
+		plane = &screen->planes[i];
+
+		if (!plane->dirty)
+			continue;
+
+		err |= drm_kms_atomic_add_plane(req, plane->id, &plane->props,
+						screen->crtc,
+						plane->surface ? plane->surface->id : 0,
+						&plane->src, &plane->dst);
+
+		if (plane->props.zpos && plane->zpos_mutable && plane->surface)
+			err |= drmModeAtomicAddProperty(req, plane->id,
+							plane->props.zpos,
+							plane->zpos);
+	}
+
+	return err;
+}
+
+static void drm_kms_screen_clean_planes(struct drm_kms_screen *screen)
+{
+	unsigned int i;
+
+	for (i = 0; i < screen->num_planes; i++)
+		screen->planes[i].dirty = false;
+}
+
+/* checks whether all outputs can make scanout wait for a surface's fence */
+static bool drm_kms_screen_in_fences(struct drm_kms_screen *screen)
+{
+	unsigned int i;
+
+	if (!screen->atomic.enabled || !screen->atomic.primary.in_fence_fd)
+		return false;
+
+	for (i = 0; i < screen->num_span; i++)
+		if (!screen->span[i]->atomic.primary.in_fence_fd)
+			return false;
+
+	return true;
+}
+
+/* checks whether all outputs can restrict updates to damaged regions */
+static bool drm_kms_screen_damage_clips(struct drm_kms_screen *screen)
+{
+	unsigned int i;
+
+	if (!screen->atomic.enabled || !screen->atomic.primary.fb_damage_clips)
+		return false;
+
+	for (i = 0; i < screen->num_span; i++)
+		if (!screen->span[i]->atomic.primary.fb_damage_clips)
+			return false;
+
+	return true;
+}
+
+/* damage clips are in framebuffer coordinates, so outputs can share them */
+static int drm_kms_surface_create_damage(struct drm_kms_surface *surface,
+					 uint32_t *blobp)
+{
+	struct drm_kms_screen *screen = surface->screen;
+	struct drm_mode_rect *clips;
+	unsigned int i;
+	int err;
+
+	clips = calloc(surface->damage.count, sizeof(*clips));
+	if (!clips)
+		return -ENOMEM;
+
+	for (i = 0; i < surface->damage.count; i++) {
+		const struct drm_kms_rect *rect = &surface->damage.rects[i];
+
+		clips[i].x1 = rect->x;
+		clips[i].y1 = rect->y;
+		clips[i].x2 = rect->x + rect->width;
+		clips[i].y2 = rect->y + rect->height;
+	}
+
+	err = drmModeCreatePropertyBlob(screen->fd, clips,
+					surface->damage.count * sizeof(*clips),
+					blobp);
+	if (err < 0)
+		err = -errno;
+
+	free(clips);
+
+	return err;
+}
+
+/*
+ * Legacy drivers for displays that need to be told about updates expose the
+ * dirty framebuffer IOCTL instead. It flushes the damaged region of a
+ * framebuffer that is already being scanned out.
+ */
+static int drm_kms_surface_flush_damage(struct drm_kms_surface *surface)
+{
+	struct drm_kms_screen *screen = surface->screen;
+	drmModeClip *clips;
+	unsigned int i;
+	int err;
+
+	clips = calloc(surface->damage.count, sizeof(*clips));
+	if (!clips)
+		return -ENOMEM;
+
+	for (i = 0; i < surface->damage.count; i++) {
+		const struct drm_kms_rect *rect = &surface->damage.rects[i];
+
+		clips[i].x1 = rect->x;
+		clips[i].y1 = rect->y;
+		clips[i].x2 = rect->x + rect->width;
+		clips[i].y2 = rect->y + rect->height;
+	}
+
+	err = drmModeDirtyFB(screen->fd, surface->id, clips,
+			     surface->damage.count);
+	if (err < 0)
+		err = -errno;
+
+	/* drivers that scan out directly from memory don't need this */
+	if (err == -ENOSYS)
+		err = 0;
+
+	free(clips);
+
+	drm_kms_surface_clear_damage(surface);
+
+	return err;
+}
+
+/*
+ * The out-fence of a commit signals when the new framebuffer has replaced
+ * the old one, so it is handed to the surface that is being scanned out.
+ */
+static void drm_kms_screen_set_release(struct drm_kms_screen *screen,
+				       struct drm_kms_surface *surface,
+				       int fence)
+{
+	struct drm_kms_surface *scanout = screen->scanout;
+
+	if (!scanout || scanout == surface) {
+		close(fence);
+		return;
+	}
+
+	if (scanout->release >= 0)
+		close(scanout->release);
+
+	scanout->release = fence;
+}
+
+static int drm_kms_screen_atomic_commit(struct drm_kms_screen *screen,
+					struct drm_kms_surface *surface,
+					uint32_t flags)
+{
+	int32_t out_fence = -1;
+	drmModeAtomicReqPtr req;
+	uint32_t damage = 0;
+	unsigned int i;
+	int err;
+
+	/* asynchronous commits can't carry an in-fence either */
+	if ((flags & DRM_MODE_ATOMIC_TEST_ONLY) == 0 &&
+	    (!drm_kms_screen_in_fences(screen) ||
+	     (flags & DRM_MODE_PAGE_FLIP_ASYNC)))
+		drm_kms_surface_wait_fence(surface);
+
+	/* a full modeset updates everything anyway */
+	if (surface->damage.count > 0 && drm_kms_screen_damage_clips(screen) &&
+	    (flags & (DRM_MODE_PAGE_FLIP_ASYNC |
+		      DRM_MODE_ATOMIC_ALLOW_MODESET)) == 0) {
+		err = drm_kms_surface_create_damage(surface, &damage);
+		if (err < 0)
+			return err;
+	}
+
+	req = drmModeAtomicAlloc();
+	if (!req) {
+		if (damage)
+			drmModeDestroyPropertyBlob(screen->fd, damage);
+
+		return -ENOMEM;
+	}
+
+	err = drm_kms_screen_atomic_add_output(screen, req, surface, damage,
+					       flags);
+
+	for (i = 0; i < screen->num_span; i++)
+		err |= drm_kms_screen_atomic_add_output(screen->span[i], req,
+							surface, damage,
+							flags);
+
+	/* overlay plane updates land in the same vertical blank */
+	if ((flags & DRM_MODE_PAGE_FLIP_ASYNC) == 0)
+		err |= drm_kms_screen_atomic_add_planes(screen, req);
+
+	if (screen->atomic.crtc.out_fence_ptr &&
+	    (flags & (DRM_MODE_PAGE_FLIP_ASYNC |
+		      DRM_MODE_ATOMIC_TEST_ONLY)) == 0)
+		err |= drmModeAtomicAddProperty(req, screen->crtc,
+						screen->atomic.crtc.out_fence_ptr,
+						(uintptr_t)&out_fence);
+
+	if (err < 0) {
+		if (damage)
+			drmModeDestroyPropertyBlob(screen->fd, damage);
+
+		drmModeAtomicFree(req);
+		return -ENOMEM;
+	}
+
+	err = drmModeAtomicCommit(screen->fd, req, flags, surface);
+	if (err < 0)
+		err = -errno;
+	else if ((flags & (DRM_MODE_PAGE_FLIP_ASYNC |
+			   DRM_MODE_ATOMIC_TEST_ONLY)) == 0)
+		drm_kms_screen_clean_planes(screen);
+
+	drmModeAtomicFree(req);
+
+	/* the commit holds its own reference to the blob */
+	if (damage)
+		drmModeDestroyPropertyBlob(screen->fd, damage);
+
+	if (err == 0 && out_fence >= 0)
+		drm_kms_screen_set_release(screen, surface, out_fence);
+
+	/* the kernel holds its own reference to the fence once committed */
+	if ((flags & DRM_MODE_ATOMIC_TEST_ONLY) == 0 && surface->fence >= 0) {
+		close(surface->fence);
+		surface->fence = -1;
+	}
+
+	return err;
+}
+
+static void drm_kms_screen_set_scanout(struct drm_kms_screen *screen,
+				       struct drm_kms_surface *surface)
+{
+	if (screen->scanout && screen->scanout != surface)
+		drm_kms_surface_set_free(screen->scanout);
+
+	surface->state = DRM_KMS_SURFACE_SCANOUT;
+	screen->scanout = surface;
+}
+
+static int drm_kms_screen_submit(struct drm_kms_screen *screen,
+				 struct drm_kms_surface *surface, bool async)
+{
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+	unsigned int i;
+	int err;
+
+	if (screen->atomic.enabled) {
+		/* overlay plane updates can't be applied asynchronously */
+		if (async && screen->atomic.async &&
+		    !drm_kms_screen_planes_dirty(screen))
+			flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+
+		flags |= DRM_MODE_ATOMIC_NONBLOCK;
+
+		err = drm_kms_screen_atomic_commit(screen, surface, flags);
+	} else {
+		if (async && screen->async)
+			flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+
+		drm_kms_surface_wait_fence(surface);
+
+		err = drmModePageFlip(screen->fd, screen->crtc, surface->id,
+				      flags, surface);
+		if (err < 0)
+			err = -errno;
+	}
+
+	/*
+	 * Drivers may reject asynchronous flips for some updates even if they
+	 * support them in general, so retry synchronized to vertical blank.
+	 */
+	if (err == -EINVAL && (flags & DRM_MODE_PAGE_FLIP_ASYNC))
+		return drm_kms_screen_submit(screen, surface, false);
+
+	if (err < 0)
+		return err;
+
+	/* damage only applies to a single flip, legacy flips ignore it */
+	drm_kms_surface_clear_damage(surface);
+
+	/* one event is sent for each CRTC that the commit touched */
+	screen->num_flips = 1 + screen->num_span;
+
+	/*
+	 * The legacy API can't flip multiple CRTCs at once, so the outputs of
+	 * a spanning screen are flipped one after another.
+	 */
+	if (!screen->atomic.enabled) {
+		for (i = 0; i < screen->num_span; i++) {
+			err = drmModePageFlip(screen->fd, screen->span[i]->crtc,
+					      surface->id, flags, surface);
+			if (err < 0) {
+				fprintf(stderr, "failed to flip CRTC %u: %d\n",
+					screen->span[i]->crtc, -errno);
+				screen->num_flips--;
+			}
+		}
+	}
+
+	surface->state = DRM_KMS_SURFACE_PENDING;
+	screen->pending = surface;
+
+	return 0;
+}
+
+static void drm_kms_screen_enqueue(struct drm_kms_screen *screen,
+				   struct drm_kms_surface *surface)
+{
+	surface->state = DRM_KMS_SURFACE_QUEUED;
+	screen->queue[screen->num_queued++] = surface;
+}
+
+/* removes a surface from the queue without submitting it */
+static bool drm_kms_screen_unqueue(struct drm_kms_screen *screen,
+				   struct drm_kms_surface *surface)
+{
+	unsigned int i;
+
+	for (i = 0; i < screen->num_queued; i++)
+		if (screen->queue[i] == surface)
+			break;
+
+	if (i == screen->num_queued)
+		return false;
+
+	screen->num_queued--;
+
+	for (; i < screen->num_queued; i++)
+		screen->queue[i] = screen->queue[i + 1];
+
+	return true;
+}
+
+static struct drm_kms_surface *
+drm_kms_screen_dequeue(struct drm_kms_screen *screen)
+{
+	struct drm_kms_surface *surface;
+	unsigned int i;
+
+	if (screen->num_queued == 0)
+		return NULL;
+
+	surface = screen->queue[0];
+	screen->num_queued--;
+
+	for (i = 0; i < screen->num_queued; i++)
+		screen->queue[i] = screen->queue[i + 1];
+
+	return surface;
+}
+
+static void drm_kms_stats_add_frame(struct drm_kms_stats *stats,
+				    struct drm_kms_surface *surface,
+				    unsigned int sequence, uint64_t timestamp,
+				    unsigned int interval)
+{
+	struct drm_kms_frame_stats *frame;
+	uint32_t delta;
+
+	if (stats->num_frames == stats->size) {
+		unsigned int size = stats->size ? stats->size * 2 : 1024;
+
+		frame = realloc(stats->frames, size * sizeof(*frame));
+		if (!frame)
+			return;
+
+		stats->frames = frame;
+		stats->size = size;
+	}
+
+	frame = &stats->frames[stats->num_frames];
+	frame->submit = surface->submitted;
+	frame->complete = drm_kms_get_time();
+	frame->timestamp = timestamp;
+	frame->sequence = sequence;
+	frame->missed = 0;
+
+	if (stats->num_frames > 0) {
+		delta = sequence - frame[-1].sequence;
+
+		if (delta > interval)
+			frame->missed = delta - interval;
+	}
+
+	stats->missed += frame->missed;
+	stats->num_frames++;
+}
+
+static void drm_kms_screen_page_flip(int fd, unsigned int sequence,
+				     unsigned int tv_sec, unsigned int tv_usec,
+				     void *data)
+{
+	struct drm_kms_surface *surface = data, *next;
+	struct drm_kms_screen *screen = surface->screen;
+	int err;
+
+	/* wait for all CRTCs of a spanning screen to complete the flip */
+	if (screen->num_flips > 1) {
+		screen->num_flips--;
+		return;
+	}
+
+	screen->num_flips = 0;
+
+	if (screen->pending == surface)
+		screen->pending = NULL;
+
+	if (screen->stats) {
+		uint64_t timestamp = tv_sec * 1000000000ull + tv_usec * 1000ull;
+		unsigned int interval = screen->schedule.interval ?: 1;
+
+		drm_kms_stats_add_frame(screen->stats, surface, sequence,
+					timestamp, interval);
+	}
+
+	drm_kms_screen_set_scanout(screen, surface);
+
+	next = drm_kms_screen_dequeue(screen);
+	if (next) {
+		err = drm_kms_screen_submit(screen, next, false);
+		if (err < 0) {
+			fprintf(stderr, "failed to flip queued surface: %d\n", err);
+			drm_kms_surface_set_free(next);
+
+			if (screen->stats)
+				screen->stats->dropped++;
+		}
+	}
+}
+
+static void drm_kms_screen_sequence(int fd, uint64_t sequence, uint64_t ns,
+				    uint64_t data)
+{
+	struct drm_kms_screen *screen = (void *)(uintptr_t)data;
+
+	screen->schedule.sequence = sequence;
+	screen->schedule.timestamp = ns;
+	screen->schedule.queued = false;
+}
+
+static int drm_kms_screen_alloc(struct drm_kms_screen **screenp, int fd,
+				const struct drm_kms_screen_args *args)
+{
+	struct drm_kms_screen *screen;
+	uint64_t value;
+
+	screen = calloc(1, sizeof(*screen));
+	if (!screen)
+		return -ENOMEM;
+
+	screen->fd = fd;
+
+	if (args->num_buffers)
+		screen->num_buffers = args->num_buffers;
+	else
+		screen->num_buffers = DRM_KMS_SCREEN_MIN_BUFFERS;
+
+	if (screen->num_buffers < DRM_KMS_SCREEN_MIN_BUFFERS ||
+	    screen->num_buffers > DRM_KMS_SCREEN_MAX_BUFFERS) {
+		free(screen);
+		return -EINVAL;
+	}
+
+	screen->present_mode = args->present_mode;
+	screen->pool.max_size = args->pool_size;
+	screen->shadow = (args->flags & DRM_KMS_SCREEN_SHADOW) != 0;
+
+	if (args->flags & DRM_KMS_SCREEN_STATS) {
+		screen->stats = calloc(1, sizeof(*screen->stats));
+		if (!screen->stats) {
+			free(screen);
+			return -ENOMEM;
+		}
+	}
+
+	if (drmGetCap(fd, DRM_CAP_ASYNC_PAGE_FLIP, &value) == 0)
+		screen->async = value != 0;
+
+	if (drmGetCap(fd, DRM_CAP_ADDFB2_MODIFIERS, &value) == 0)
+		screen->modifiers = value != 0;
+
+	screen->events.version = DRM_EVENT_CONTEXT_VERSION;
+	screen->events.page_flip_handler = drm_kms_screen_page_flip;
+	screen->events.sequence_handler = drm_kms_screen_sequence;
+
+	*screenp = screen;
+
+	return 0;
+}
+
+static void drm_kms_screen_init_output(struct drm_kms_screen *screen,
+				       const struct drm_kms_screen_args *args)
+{
+	int err;
+
+	screen->original_crtc = drmModeGetCrtc(screen->fd, screen->crtc);
+
+	if ((args->flags & DRM_KMS_SCREEN_LEGACY) == 0) {
+		err = drm_kms_screen_init_atomic(screen);
+		if (err < 0)
+			fprintf(stderr, "atomic modesetting not available, using legacy: %d\n", err);
+	}
+}
+
+static int drm_kms_screen_init_swapchain(struct drm_kms_screen *screen,
+					 const struct drm_kms_screen_args *args)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < screen->num_buffers; i++) {
+		err = drm_kms_surface_create(&screen->fb[i], screen,
+					     screen->width, screen->height,
+					     args->format);
+		if (err < 0) {
+			fprintf(stderr, "drm_kms_surface_create_with_format() failed: %d\n", err);
+			return err;
+		}
+	}
+
+	drm_kms_screen_swap(screen);
+
+	return 0;
+}
+
+/*
+ * Checks whether the primary plane can scale a render-sized framebuffer up
+ * to the full mode. If it can't, the screen's framebuffers remain full-size
+ * and clients have to do the scaling on the GPU.
+ */
+static int drm_kms_screen_init_scaling(struct drm_kms_screen *screen,
+				       const struct drm_kms_screen_args *args)
+{
+	struct drm_kms_surface *surface;
+	int err;
+
+	if (args->render_width > screen->mode.hdisplay ||
+	    args->render_height > screen->mode.vdisplay)
+		return -EINVAL;
+
+	screen->render.width = args->render_width;
+	screen->render.height = args->render_height;
+
+	if (!screen->atomic.enabled) {
+		fprintf(stderr, "plane scaling requires atomic modesetting, scaling on GPU\n");
+		return 0;
+	}
+
+	err = drm_kms_surface_create(&surface, screen, args->render_width,
+				     args->render_height, args->format);
+	if (err < 0)
+		return err;
+
+	screen->render.scaled = true;
+
+	err = drm_kms_screen_atomic_commit(screen, surface,
+					   DRM_MODE_ATOMIC_TEST_ONLY |
+					   DRM_MODE_ATOMIC_ALLOW_MODESET);
+	if (err < 0) {
+		fprintf(stderr, "plane scaling not supported, scaling on GPU: %d\n", err);
+		screen->render.scaled = false;
+	} else {
+		screen->width = args->render_width;
+		screen->height = args->render_height;
+	}
+
+	drm_kms_surface_free(surface);
+
+	return 0;
+}
+
+/*
+ * Sets up the swapchain and performs the initial modeset once an output
+ * (connector, CRTC and mode) has been chosen for the screen.
+ */
+static int drm_kms_screen_setup(struct drm_kms_screen *screen,
+				const struct drm_kms_screen_args *args)
+{
+	int err;
+
+	drm_kms_screen_init_output(screen, args);
+
+	if (args->flags & DRM_KMS_SCREEN_FULLSCREEN) {
+		screen->width = screen->mode.hdisplay;
+		screen->height = screen->mode.vdisplay;
+	} else {
+		screen->width = args->width;
 		screen->height = args->height;
 	}
 
-	for (i = 0; i < 2; i++) {
-		err = drm_kms_surface_create(&screen->fb[i], screen,
-					     screen->width, screen->height,
-					     args->format);
+	screen->render.width = screen->width;
+	screen->render.height = screen->height;
+
+	if (args->render_width && args->render_height) {
+		err = drm_kms_screen_init_scaling(screen, args);
+		if (err < 0)
+			return err;
+	}
+
+	return drm_kms_screen_init_swapchain(screen, args);
+}
+
+int drm_kms_screen_create_with_args(struct drm_kms_screen **screenp, int fd,
+				    const struct drm_kms_screen_args *args)
+{
+	struct drm_kms_screen *screen;
+	int err;
+
+	err = drmSetMaster(fd);
+	if (err < 0)
+		return -errno;
+
+	err = drm_kms_screen_alloc(&screen, fd, args);
+	if (err < 0)
+		return err;
+
+	screen->master = true;
+
+	err = drm_kms_screen_choose_output(screen);
+	if (err < 0)
+		return err;
+
+	err = drm_kms_screen_setup(screen, args);
+	if (err < 0)
+		return err;
+
+	*screenp = screen;
+
+	return 0;
+}
+
+int drm_kms_screen_create(struct drm_kms_screen **screenp, int fd)
+{
+	struct drm_kms_screen_args args;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = DRM_KMS_SCREEN_FULLSCREEN;
+	args.format = DRM_FORMAT_XRGB8888;
+
+	return drm_kms_screen_create_with_args(screenp, fd, &args);
+}
+
+void drm_kms_screen_free(struct drm_kms_screen *screen)
+{
+	drmModeCrtcPtr crtc;
+	unsigned int i;
+
+	if (!screen)
+		return;
+
+	drm_kms_screen_wait_flip(screen);
+
+	for (i = 0; i < screen->num_span; i++)
+		drm_kms_screen_free(screen->span[i]);
+
+	free(screen->span);
+
+	for (i = 0; i < screen->num_planes; i++)
+		free(screen->planes[i].formats);
+
+	free(screen->planes);
+
+	crtc = screen->original_crtc;
+	if (crtc) {
+		drmModeSetCrtc(screen->fd, crtc->crtc_id, crtc->buffer_id,
+			       crtc->x, crtc->y, &screen->connector, 1,
+			       &crtc->mode);
+		drmModeFreeCrtc(crtc);
+	}
+
+	/* surfaces freed while on screen are only released now */
+	if (screen->scanout) {
+		drm_kms_surface_set_free(screen->scanout);
+		screen->scanout = NULL;
+	}
+
+	for (i = 0; i < screen->num_buffers; i++)
+		drm_kms_surface_free(screen->fb[i]);
+
+	drm_kms_screen_trim_pool(screen, 0);
+	free(screen->pool.surfaces);
+
+	while (screen->num_imports > 0)
+		drm_kms_surface_destroy_import(screen->imports[0]);
+
+	free(screen->imports);
+	free(screen->handles);
+
+	if (screen->atomic.mode)
+		drmModeDestroyPropertyBlob(screen->fd, screen->atomic.mode);
+
+	if (screen->stats) {
+		free(screen->stats->frames);
+		free(screen->stats);
+	}
+
+	if (screen->master)
+		drmDropMaster(screen->fd);
+
+	free(screen);
+}
+
+int drm_kms_screen_open_with_args(struct drm_kms_screen **screenp,
+				  const char *path,
+				  const struct drm_kms_screen_args *args)
+{
+	int fd, err;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -errno;
+
+	err = drm_kms_screen_create_with_args(screenp, fd, args);
+	if (err < 0) {
+		close(fd);
+		return err;
+	}
+
+	return 0;
+}
+
+void drm_kms_screen_close(struct drm_kms_screen *screen)
+{
+	int fd = screen->fd;
+
+	drm_kms_screen_free(screen);
+	close(fd);
+}
+
+static const drmModeModeInfo *
+drm_kms_connector_get_mode(const drmModeConnector *connector)
+{
+	int i;
+
+	for (i = 0; i < connector->count_modes; i++)
+		if (connector->modes[i].type & DRM_MODE_TYPE_PREFERRED)
+			return &connector->modes[i];
+
+	return &connector->modes[0];
+}
+
+/*
+ * Picks a CRTC that isn't in the used mask for a connector, preferring the
+ * one that is currently driving it. Returns the CRTC's index.
+ */
+static int drm_kms_display_assign_crtc(struct drm_kms_display *display,
+				       const drmModeRes *res,
+				       const drmModeConnector *connector,
+				       uint32_t *used)
+{
+	drmModeEncoder *encoder;
+	int i, j;
+
+	encoder = drmModeGetEncoder(display->fd, connector->encoder_id);
+	if (encoder) {
+		for (j = 0; j < res->count_crtcs; j++) {
+			if (res->crtcs[j] == encoder->crtc_id &&
+			    (*used & (1 << j)) == 0) {
+				drmModeFreeEncoder(encoder);
+				*used |= 1 << j;
+				return j;
+			}
+		}
+
+		drmModeFreeEncoder(encoder);
+	}
+
+	for (i = 0; i < connector->count_encoders; i++) {
+		encoder = drmModeGetEncoder(display->fd,
+					    connector->encoders[i]);
+		if (!encoder)
+			continue;
+
+		for (j = 0; j < res->count_crtcs; j++) {
+			if ((encoder->possible_crtcs & (1 << j)) &&
+			    (*used & (1 << j)) == 0) {
+				drmModeFreeEncoder(encoder);
+				*used |= 1 << j;
+				return j;
+			}
+		}
+
+		drmModeFreeEncoder(encoder);
+	}
+
+	return -ENODEV;
+}
+
+/*
+ * Turns the outputs of a display into a single screen whose buffers cover
+ * all of them. Outputs are laid out left to right, starting a new row after
+ * every args->columns outputs, and scan out from their offset within the
+ * shared buffers. The first output owns the swapchain and flips the others
+ * along with it.
+ */
+static int drm_kms_display_span(struct drm_kms_display *display,
+				const struct drm_kms_screen_args *args)
+{
+	struct drm_kms_screen *screen = display->screens[0], *output;
+	unsigned int columns = args->columns ?: display->num_screens;
+	unsigned int width = 0, height = 0, x = 0, y = 0, row = 0;
+	bool atomic = true;
+	unsigned int i;
+
+	for (i = 0; i < display->num_screens; i++) {
+		output = display->screens[i];
+
+		if (i > 0 && i % columns == 0) {
+			y += row;
+			row = 0;
+			x = 0;
+		}
+
+		output->x = x;
+		output->y = y;
+		output->width = output->mode.hdisplay;
+		output->height = output->mode.vdisplay;
+
+		x += output->mode.hdisplay;
+
+		if (output->mode.vdisplay > row)
+			row = output->mode.vdisplay;
+
+		if (x > width)
+			width = x;
+
+		if (y + row > height)
+			height = y + row;
+
+		drm_kms_screen_init_output(output, args);
+
+		if (!output->atomic.enabled)
+			atomic = false;
+	}
+
+	/* all CRTCs need to be updated in one commit, or not at all */
+	if (!atomic)
+		for (i = 0; i < display->num_screens; i++)
+			display->screens[i]->atomic.enabled = false;
+
+	if (display->num_screens > 1) {
+		screen->num_span = display->num_screens - 1;
+
+		screen->span = calloc(screen->num_span, sizeof(*screen->span));
+		if (!screen->span)
+			return -ENOMEM;
+
+		for (i = 0; i < screen->num_span; i++)
+			screen->span[i] = display->screens[i + 1];
+
+		display->num_screens = 1;
+	}
+
+	screen->width = width;
+	screen->height = height;
+	screen->render.width = width;
+	screen->render.height = height;
+
+	return drm_kms_screen_init_swapchain(screen, args);
+}
+
+/*
+ * Creates a screen, with its own swapchain, for every connected output that
+ * a CRTC can be assigned to. If DRM_KMS_SCREEN_SPAN is passed, a single
+ * screen spanning all outputs is created instead.
+ */
+int drm_kms_display_create(struct drm_kms_display **displayp, int fd,
+			   const struct drm_kms_screen_args *args)
+{
+	struct drm_kms_display *display;
+	struct drm_kms_screen *screen;
+	drmModeConnector *connector;
+	uint32_t used = 0;
+	drmModeRes *res;
+	int i, pipe, err;
+
+	err = drmSetMaster(fd);
+	if (err < 0)
+		return -errno;
+
+	display = calloc(1, sizeof(*display));
+	if (!display)
+		return -ENOMEM;
+
+	display->fd = fd;
+
+	res = drmModeGetResources(fd);
+	if (!res) {
+		free(display);
+		return -ENODEV;
+	}
+
+	display->screens = calloc(res->count_connectors,
+				  sizeof(*display->screens));
+	if (!display->screens) {
+		drmModeFreeResources(res);
+		free(display);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < res->count_connectors; i++) {
+		connector = drmModeGetConnector(fd, res->connectors[i]);
+		if (!connector)
+			continue;
+
+		if (connector->connection != DRM_MODE_CONNECTED ||
+		    connector->count_modes == 0) {
+			drmModeFreeConnector(connector);
+			continue;
+		}
+
+		pipe = drm_kms_display_assign_crtc(display, res, connector,
+						   &used);
+		if (pipe < 0) {
+			fprintf(stderr, "no CRTC available for connector %u\n",
+				connector->connector_id);
+			drmModeFreeConnector(connector);
+			continue;
+		}
+
+		err = drm_kms_screen_alloc(&screen, fd, args);
+		if (err < 0) {
+			drmModeFreeConnector(connector);
+			break;
+		}
+
+		screen->connector = connector->connector_id;
+		screen->mode = *drm_kms_connector_get_mode(connector);
+		screen->crtc = res->crtcs[pipe];
+		screen->pipe = pipe;
+
+		drmModeFreeConnector(connector);
+
+		display->screens[display->num_screens++] = screen;
+
+		if (args->flags & DRM_KMS_SCREEN_SPAN)
+			continue;
+
+		err = drm_kms_screen_setup(screen, args);
+		if (err < 0)
+			break;
+	}
+
+	drmModeFreeResources(res);
+
+	if (err == 0 && display->num_screens == 0)
+		err = -ENODEV;
+
+	if (err == 0 && (args->flags & DRM_KMS_SCREEN_SPAN))
+		err = drm_kms_display_span(display, args);
+
+	if (err < 0) {
+		drm_kms_display_free(display);
+		return err;
+	}
+
+	*displayp = display;
+
+	return 0;
+}
+
+void drm_kms_display_free(struct drm_kms_display *display)
+{
+	unsigned int i;
+
+	if (!display)
+		return;
+
+	for (i = 0; i < display->num_screens; i++)
+		drm_kms_screen_free(display->screens[i]);
+
+	drmDropMaster(display->fd);
+	free(display->screens);
+	free(display);
+}
+
+int drm_kms_display_open(struct drm_kms_display **displayp, const char *path,
+			 const struct drm_kms_screen_args *args)
+{
+	int fd, err;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -errno;
+
+	err = drm_kms_display_create(displayp, fd, args);
+	if (err < 0) {
+		close(fd);
+		return err;
+	}
+
+	return 0;
+}
+
+void drm_kms_display_close(struct drm_kms_display *display)
+{
+	int fd = display->fd;
+
+	drm_kms_display_free(display);
+	close(fd);
+}
+
+/*
+ * All screens of a display share the DRM file descriptor and events are
+ * routed to the screen that they belong to, so a single dispatch handles
+ * completions for every CRTC.
+ */
+int drm_kms_display_dispatch(struct drm_kms_display *display, int timeout)
+{
+	if (!display)
+		return -EINVAL;
+
+	return drm_kms_screen_dispatch(display->screens[0], timeout);
+}
+
+int drm_kms_screen_swap(struct drm_kms_screen *screen)
+{
+	int err;
+
+	if (!screen)
+		return -EINVAL;
+
+	err = drm_kms_screen_swap_to(screen, screen->fb[screen->current]);
+	if (err < 0)
+		return err;
+
+	screen->current = (screen->current + 1) % screen->num_buffers;
+
+	return 0;
+}
+
+int drm_kms_screen_swap_to(struct drm_kms_screen *screen,
+			   struct drm_kms_surface *surface)
+{
+	unsigned int i;
+	int err;
+
+	if (!screen || !surface)
+		return -EINVAL;
+
+	err = drm_kms_screen_wait_flip(screen);
+	if (err < 0)
+		return err;
+
+	if (screen->atomic.enabled) {
+		err = drm_kms_screen_atomic_commit(screen, surface,
+						   DRM_MODE_ATOMIC_ALLOW_MODESET);
+		if (err < 0)
+			return err;
+	} else {
+		drm_kms_surface_wait_fence(surface);
+
+		err = drmModeSetCrtc(screen->fd, screen->crtc, surface->id,
+				     screen->x, screen->y, &screen->connector,
+				     1, &screen->mode);
+		if (err < 0)
+			return -errno;
+
+		for (i = 0; i < screen->num_span; i++) {
+			struct drm_kms_screen *output = screen->span[i];
+
+			err = drmModeSetCrtc(screen->fd, output->crtc,
+					     surface->id, output->x, output->y,
+					     &output->connector, 1,
+					     &output->mode);
+			if (err < 0)
+				return -errno;
+		}
+	}
+
+	drm_kms_surface_clear_damage(surface);
+	drm_kms_screen_set_scanout(screen, surface);
+
+	return 0;
+}
+
+int drm_kms_screen_flip(struct drm_kms_screen *screen, void *data)
+{
+	int err;
+
+	if (!screen)
+		return -EINVAL;
+
+	err = drm_kms_screen_flip_to(screen, screen->fb[screen->current],
+				     data);
+	if (err < 0)
+		return err;
+
+	screen->current = (screen->current + 1) % screen->num_buffers;
+
+	return 0;
+}
+
+int drm_kms_screen_flip_to(struct drm_kms_screen *screen,
+			   struct drm_kms_surface *surface, void *data)
+{
+	return drm_kms_screen_flip_to_with_flags(screen, surface, 0, data);
+}
+
+/*
+ * Like drm_kms_screen_flip_to(), but allows per-frame flags. If the
+ * DRM_KMS_FLIP_ASYNC flag is set, or the screen uses the asynchronous
+ * present mode, the flip is not synchronized to vertical blank when the
+ * driver supports it. Otherwise it falls back to a regular page-flip.
+ */
+int drm_kms_screen_flip_to_with_flags(struct drm_kms_screen *screen,
+				      struct drm_kms_surface *surface,
+				      unsigned long flags, void *data)
+{
+	int err;
+
+	if (!screen || !surface)
+		return -EINVAL;
+
+	surface->submitted = drm_kms_get_time();
+	surface->data = data;
+
+	if (screen->present_mode == DRM_KMS_PRESENT_MODE_ASYNC)
+		flags |= DRM_KMS_FLIP_ASYNC;
+
+	/*
+	 * Presenting the surface that is being scanned out again only needs
+	 * its damaged region to be flushed, which drivers without damage
+	 * clips support through the dirty framebuffer IOCTL. No page-flip
+	 * event is generated in that case.
+	 */
+	if (surface == screen->scanout && !screen->pending &&
+	    screen->num_queued == 0 && surface->damage.count > 0 &&
+	    !drm_kms_screen_damage_clips(screen))
+		return drm_kms_surface_flush_damage(surface);
+
+	if (flags & DRM_KMS_FLIP_ASYNC) {
+		err = drm_kms_screen_wait_flip(screen);
+		if (err < 0)
+			return err;
+
+		return drm_kms_screen_submit(screen, surface, true);
+	}
+
+	/*
+	 * Only a single page-flip can be outstanding per CRTC, so frames that
+	 * are presented while a flip is pending are queued and submitted from
+	 * the page-flip event handler.
+	 */
+	switch (screen->present_mode) {
+	case DRM_KMS_PRESENT_MODE_FIFO:
+		while (screen->pending &&
+		       screen->num_queued == DRM_KMS_SCREEN_MAX_BUFFERS) {
+			err = drm_kms_screen_dispatch(screen, -1);
+			if (err < 0)
+				return err;
+		}
+
+		break;
+
+	case DRM_KMS_PRESENT_MODE_MAILBOX:
+		if (screen->pending) {
+			struct drm_kms_surface *stale;
+
+			while ((stale = drm_kms_screen_dequeue(screen))) {
+				drm_kms_surface_set_free(stale);
+
+				if (screen->stats)
+					screen->stats->dropped++;
+			}
+		}
+
+		break;
+
+	/*
+	 * Unlike FIFO, nothing is ever queued: presenting blocks until the
+	 * pending flip has completed, so that at most one frame is in flight
+	 * and the latency stays below two refresh cycles.
+	 */
+	case DRM_KMS_PRESENT_MODE_IMMEDIATE:
+	case DRM_KMS_PRESENT_MODE_ASYNC:
+		err = drm_kms_screen_wait_flip(screen);
+		if (err < 0)
+			return err;
+
+		break;
+	}
+
+	if (screen->pending) {
+		drm_kms_screen_enqueue(screen, surface);
+		return 0;
+	}
+
+	return drm_kms_screen_submit(screen, surface, false);
+}
+
+static int drm_kms_screen_poll(struct drm_kms_screen *screen,
+			       const struct timespec *timeout)
+{
+	struct pollfd fds;
+	int err;
+
+	memset(&fds, 0, sizeof(fds));
+	fds.fd = screen->fd;
+	fds.events = POLLIN;
+
+	err = ppoll(&fds, 1, timeout, NULL);
+	if (err < 0) {
+		if (errno == EINTR)
+			return 0;
+
+		return -errno;
+	}
+
+	if (err == 0)
+		return 0;
+
+	if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
+		return -EIO;
+
+	err = drmHandleEvent(screen->fd, &screen->events);
+	if (err < 0)
+		return -EIO;
+
+	return 1;
+}
+
+static int drm_kms_plane_init(struct drm_kms_plane *plane,
+			      struct drm_kms_screen *screen,
+			      const drmModePlane *p)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	int err;
+
+	plane->screen = screen;
+	plane->id = p->plane_id;
+
+	err = drm_kms_plane_get_props(screen->fd, plane->id, &plane->props);
+	if (err < 0)
+		return err;
+
+	plane->formats = calloc(p->count_formats, sizeof(*plane->formats));
+	if (!plane->formats)
+		return -ENOMEM;
+
+	memcpy(plane->formats, p->formats,
+	       p->count_formats * sizeof(*plane->formats));
+	plane->num_formats = p->count_formats;
+
+	if (plane->props.zpos == 0)
+		return 0;
+
+	props = drmModeObjectGetProperties(screen->fd, plane->id,
+					   DRM_MODE_OBJECT_PLANE);
+	if (props) {
+		drm_kms_object_find_property(screen->fd, props, "zpos", NULL,
+					     &plane->zpos);
+		drmModeFreeObjectProperties(props);
+	}
+
+	prop = drmModeGetProperty(screen->fd, plane->props.zpos);
+	if (prop) {
+		if ((prop->flags & DRM_MODE_PROP_RANGE) &&
+		    prop->count_values >= 2) {
+			plane->zpos_min = prop->values[0];
+			plane->zpos_max = prop->values[1];
+		}
+
+		plane->zpos_mutable = !(prop->flags & DRM_MODE_PROP_IMMUTABLE);
+		drmModeFreeProperty(prop);
+	}
+
+	return 0;
+}
+
+/*
+ * Finds the overlay planes that can be used with the screen's CRTC. The
+ * planes, along with the formats they support, are available from the
+ * screen's planes array afterwards.
+ */
+int drm_kms_screen_enumerate_planes(struct drm_kms_screen *screen)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePlaneResPtr res;
+	drmModePlanePtr plane;
+	uint64_t type;
+	uint32_t i;
+	int err;
+
+	if (!screen)
+		return -EINVAL;
+
+	if (screen->planes)
+		return 0;
+
+	/* needed to tell overlay planes apart from primary and cursor */
+	drmSetClientCap(screen->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+
+	res = drmModeGetPlaneResources(screen->fd);
+	if (!res)
+		return -errno;
+
+	screen->planes = calloc(res->count_planes, sizeof(*screen->planes));
+	if (!screen->planes) {
+		drmModeFreePlaneResources(res);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < res->count_planes; i++) {
+		plane = drmModeGetPlane(screen->fd, res->planes[i]);
+		if (!plane)
+			continue;
+
+		if ((plane->possible_crtcs & (1 << screen->pipe)) == 0) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+
+		props = drmModeObjectGetProperties(screen->fd, plane->plane_id,
+						   DRM_MODE_OBJECT_PLANE);
+		if (!props) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+
+		err = drm_kms_object_find_property(screen->fd, props, "type",
+						   NULL, &type);
+		drmModeFreeObjectProperties(props);
+
+		if (err < 0 || type != DRM_PLANE_TYPE_OVERLAY) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+
+		err = drm_kms_plane_init(&screen->planes[screen->num_planes],
+					 screen, plane);
+		drmModeFreePlane(plane);
+
 		if (err < 0) {
-			fprintf(stderr, "drm_kms_surface_create_with_format() failed: %d\n", err);
-			return err;
+			fprintf(stderr, "failed to initialize plane %u: %d\n",
+				res->planes[i], err);
+			continue;
 		}
+
+		screen->num_planes++;
 	}
 
-	drm_kms_screen_swap(screen);
+	drmModeFreePlaneResources(res);
 
-	*screenp = screen;
+	return 0;
+}
+
+/*
+ * Commits pending overlay plane changes. Changes are also applied with the
+ * next page-flip, so this is only needed if the primary plane doesn't
+ * change. Legacy drivers apply changes immediately.
+ */
+int drm_kms_screen_update_planes(struct drm_kms_screen *screen)
+{
+	drmModeAtomicReqPtr req;
+	int err;
+
+	if (!screen)
+		return -EINVAL;
+
+	if (!screen->atomic.enabled || !drm_kms_screen_planes_dirty(screen))
+		return 0;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	err = drm_kms_screen_atomic_add_planes(screen, req);
+	if (err < 0) {
+		drmModeAtomicFree(req);
+		return -ENOMEM;
+	}
+
+	err = drmModeAtomicCommit(screen->fd, req, 0, NULL);
+	if (err < 0)
+		err = -errno;
+	else
+		drm_kms_screen_clean_planes(screen);
+
+	drmModeAtomicFree(req);
+
+	return err;
+}
+
+bool drm_kms_plane_supports_format(const struct drm_kms_plane *plane,
+				   uint32_t format)
+{
+	unsigned int i;
+
+	for (i = 0; i < plane->num_formats; i++)
+		if (plane->formats[i] == format)
+			return true;
+
+	return false;
+}
+
+/*
+ * Scans out the src rectangle of a surface to the dst rectangle of the
+ * screen's CRTC on an overlay plane. The whole surface is used, unscaled at
+ * the top-left corner, if src or dst are NULL. A negative zpos keeps the
+ * plane's current stacking position.
+ */
+int drm_kms_plane_attach(struct drm_kms_plane *plane,
+			 struct drm_kms_surface *surface,
+			 const struct drm_kms_rect *src,
+			 const struct drm_kms_rect *dst, int zpos)
+{
+	struct drm_kms_screen *screen;
+	int err;
+
+	if (!plane || !surface)
+		return -EINVAL;
+
+	if (!drm_kms_plane_supports_format(plane, surface->format))
+		return -EINVAL;
+
+	if (zpos >= 0 && (!plane->zpos_mutable || zpos < plane->zpos_min ||
+			  zpos > plane->zpos_max))
+		return -EINVAL;
+
+	screen = plane->screen;
+
+	if (src) {
+		plane->src = *src;
+	} else {
+		plane->src.x = 0;
+		plane->src.y = 0;
+		plane->src.width = surface->width;
+		plane->src.height = surface->height;
+	}
+
+	if (dst) {
+		plane->dst = *dst;
+	} else {
+		plane->dst.x = 0;
+		plane->dst.y = 0;
+		plane->dst.width = plane->src.width;
+		plane->dst.height = plane->src.height;
+	}
+
+	if (zpos >= 0)
+		plane->zpos = zpos;
+
+	plane->surface = surface;
+	plane->dirty = true;
+
+	if (screen->atomic.enabled)
+		return 0;
+
+	if (zpos >= 0) {
+		err = drmModeObjectSetProperty(screen->fd, plane->id,
+					       DRM_MODE_OBJECT_PLANE,
+					       plane->props.zpos, zpos);
+		if (err < 0)
+			return -errno;
+	}
+
+	err = drmModeSetPlane(screen->fd, plane->id, screen->crtc,
+			      surface->id, 0, plane->dst.x, plane->dst.y,
+			      plane->dst.width, plane->dst.height,
+			      plane->src.x << 16, plane->src.y << 16,
+			      plane->src.width << 16, plane->src.height << 16);
+	if (err < 0)
+		return -errno;
+
+	plane->dirty = false;
 
 	return 0;
 }
 
-int drm_kms_screen_create(struct drm_kms_screen **screenp, int fd)
+int drm_kms_plane_detach(struct drm_kms_plane *plane)
 {
-	struct drm_kms_screen_args args;
+	struct drm_kms_screen *screen;
+	int err;
 
-	memset(&args, 0, sizeof(args));
-	args.flags = DRM_KMS_SCREEN_FULLSCREEN;
-	args.format = DRM_FORMAT_XRGB8888;
+	if (!plane)
+		return -EINVAL;
 
-	return drm_kms_screen_create_with_args(screenp, fd, &args);
+	screen = plane->screen;
+
+	plane->surface = NULL;
+	plane->dirty = true;
+
+	if (screen->atomic.enabled)
+		return 0;
+
+	err = drmModeSetPlane(screen->fd, plane->id, 0, 0, 0, 0, 0, 0, 0, 0,
+			      0, 0, 0);
+	if (err < 0)
+		return -errno;
+
+	plane->dirty = false;
+
+	return 0;
 }
 
-void drm_kms_screen_free(struct drm_kms_screen *screen)
+/*
+ * Creates a hardware cursor from an ARGB8888 image with the hotspot at
+ * (hot_x, hot_y). The image is uploaded once, after which moving the cursor
+ * is a single ioctl and doesn't require the screen to be redrawn.
+ *
+ * The legacy cursor IOCTLs are used even with atomic modesetting. Drivers
+ * implement them on top of the cursor plane, but update it without waiting
+ * for vertical blank, so that cursor updates never stall or collide with
+ * pending page-flips.
+ */
+int drm_kms_cursor_create(struct drm_kms_cursor **cursorp,
+			  struct drm_kms_screen *screen, const uint32_t *image,
+			  unsigned int width, unsigned int height,
+			  int hot_x, int hot_y)
 {
-	drmModeCrtcPtr crtc;
+	uint64_t max_width = 64, max_height = 64;
+	struct drm_kms_cursor *cursor;
 	unsigned int i;
+	int err;
 
-	if (!screen)
+	if (!screen || !image)
+		return -EINVAL;
+
+	drmGetCap(screen->fd, DRM_CAP_CURSOR_WIDTH, &max_width);
+	drmGetCap(screen->fd, DRM_CAP_CURSOR_HEIGHT, &max_height);
+
+	if (width > max_width || height > max_height)
+		return -EINVAL;
+
+	cursor = calloc(1, sizeof(*cursor));
+	if (!cursor)
+		return -ENOMEM;
+
+	cursor->screen = screen;
+	cursor->width = max_width;
+	cursor->height = max_height;
+	cursor->hot_x = hot_x;
+	cursor->hot_y = hot_y;
+
+	/* many drivers only accept cursors of exactly the advertised size */
+	err = drm_kms_bo_create(&cursor->bo, screen->fd, cursor->width,
+				cursor->height, 32);
+	if (err < 0) {
+		free(cursor);
+		return err;
+	}
+
+	err = drm_kms_bo_map(cursor->bo);
+	if (err < 0) {
+		drm_kms_bo_free(cursor->bo);
+		free(cursor);
+		return err;
+	}
+
+	memset(cursor->bo->ptr, 0, cursor->bo->size);
+
+	for (i = 0; i < height; i++)
+		memcpy(cursor->bo->ptr + i * cursor->bo->pitch,
+		       image + i * width, width * sizeof(*image));
+
+	drm_kms_bo_unmap(cursor->bo);
+
+	*cursorp = cursor;
+
+	return 0;
+}
+
+void drm_kms_cursor_free(struct drm_kms_cursor *cursor)
+{
+	if (!cursor)
 		return;
 
-	crtc = screen->original_crtc;
-	drmModeSetCrtc(screen->fd, crtc->crtc_id, crtc->buffer_id, crtc->x,
-		       crtc->y, &screen->connector, 1, &crtc->mode);
-	drmModeFreeCrtc(crtc);
+	if (cursor->visible)
+		drm_kms_cursor_hide(cursor);
+
+	drm_kms_bo_free(cursor->bo);
+	free(cursor);
+}
+
+int drm_kms_cursor_show(struct drm_kms_cursor *cursor)
+{
+	struct drm_kms_screen *screen;
+	int err;
+
+	if (!cursor)
+		return -EINVAL;
+
+	screen = cursor->screen;
+
+	err = drmModeSetCursor2(screen->fd, screen->crtc, cursor->bo->handle,
+				cursor->width, cursor->height, cursor->hot_x,
+				cursor->hot_y);
+	if (err < 0)
+		return -errno;
+
+	cursor->visible = true;
+
+	return drm_kms_cursor_move(cursor, cursor->x, cursor->y);
+}
+
+int drm_kms_cursor_hide(struct drm_kms_cursor *cursor)
+{
+	struct drm_kms_screen *screen;
+	int err;
+
+	if (!cursor)
+		return -EINVAL;
+
+	screen = cursor->screen;
+
+	err = drmModeSetCursor(screen->fd, screen->crtc, 0, 0, 0);
+	if (err < 0)
+		return -errno;
+
+	cursor->visible = false;
+
+	return 0;
+}
+
+/*
+ * Moves the cursor's hotspot to (x, y). The position is remembered while the
+ * cursor is hidden and applied when it is shown again.
+ */
+int drm_kms_cursor_move(struct drm_kms_cursor *cursor, int x, int y)
+{
+	struct drm_kms_screen *screen;
+	int err;
+
+	if (!cursor)
+		return -EINVAL;
+
+	screen = cursor->screen;
+	cursor->x = x;
+	cursor->y = y;
+
+	if (!cursor->visible)
+		return 0;
+
+	err = drmModeMoveCursor(screen->fd, screen->crtc, x - cursor->hot_x,
+				y - cursor->hot_y);
+	if (err < 0)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Waits up to timeout milliseconds (or indefinitely if timeout is negative)
+ * for events on the screen's DRM file descriptor and dispatches them. Returns
+ * 1 if events were processed, 0 on timeout or a negative error code.
+ */
+int drm_kms_screen_dispatch(struct drm_kms_screen *screen, int timeout)
+{
+	struct timespec ts;
+
+	if (!screen)
+		return -EINVAL;
+
+	if (timeout < 0)
+		return drm_kms_screen_poll(screen, NULL);
 
-	for (i = 0; i < 2; i++)
-		drm_kms_surface_free(screen->fb[i]);
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
 
-	drmDropMaster(screen->fd);
-	free(screen);
+	return drm_kms_screen_poll(screen, &ts);
 }
 
-int drm_kms_screen_open_with_args(struct drm_kms_screen **screenp,
-				  const char *path,
-				  const struct drm_kms_screen_args *args)
+/*
+ * Dispatches events until the given CLOCK_MONOTONIC time (in nanoseconds),
+ * so that page-flips keep being processed while the caller is waiting.
+ */
+static int drm_kms_screen_dispatch_until(struct drm_kms_screen *screen,
+					 uint64_t deadline)
 {
-	int fd, err;
+	struct timespec ts;
+	uint64_t now;
+	int err;
 
-	fd = open(path, O_RDWR);
-	if (fd < 0)
-		return -errno;
+	while ((now = drm_kms_get_time()) < deadline) {
+		ts.tv_sec = (deadline - now) / 1000000000;
+		ts.tv_nsec = (deadline - now) % 1000000000;
 
-	err = drm_kms_screen_create_with_args(screenp, fd, args);
-	if (err < 0) {
-		close(fd);
-		return err;
+		err = drm_kms_screen_poll(screen, &ts);
+		if (err < 0)
+			return err;
 	}
 
 	return 0;
 }
 
-void drm_kms_screen_close(struct drm_kms_screen *screen)
+/*
+ * Sets up render scheduling for the screen. Frames are paced to every
+ * interval-th vertical blank (1 for the full refresh rate, 2 for half of
+ * it and so on) and drm_kms_screen_wait_frame() returns margin microseconds
+ * before the vertical blank that the next frame should be displayed at.
+ */
+int drm_kms_screen_schedule(struct drm_kms_screen *screen,
+			    unsigned int interval, unsigned int margin)
 {
-	int fd = screen->fd;
+	uint64_t sequence, ns, period;
+	int err;
 
-	drm_kms_screen_free(screen);
-	close(fd);
+	if (!screen || interval == 0)
+		return -EINVAL;
+
+	period = drm_kms_mode_get_period(&screen->mode);
+	if (period == 0)
+		return -EINVAL;
+
+	/* check that the kernel supports CRTC sequence queries */
+	err = drmCrtcGetSequence(screen->fd, screen->crtc, &sequence, &ns);
+	if (err < 0)
+		return -errno;
+
+	screen->schedule.interval = interval;
+	screen->schedule.margin = margin;
+	screen->schedule.period = period;
+	screen->schedule.target = 0;
+	screen->schedule.missed = 0;
+
+	return 0;
 }
 
-int drm_kms_screen_swap(struct drm_kms_screen *screen)
+/*
+ * Blocks until the configured margin before the vertical blank at which the
+ * next frame should be displayed and returns that vertical blank's sequence
+ * number. Targets advance in multiples of the interval from the first frame
+ * so that divisor frame rates don't drift. Targets that have already passed
+ * are skipped and accounted for as missed.
+ */
+int drm_kms_screen_wait_frame(struct drm_kms_screen *screen,
+			      uint64_t *sequencep)
 {
-	struct drm_kms_surface *fb = screen->fb[screen->current];
+	uint64_t sequence, ns, anchor, margin, deadline;
+	unsigned int interval;
 	int err;
 
-	if (!screen)
+	if (!screen || screen->schedule.interval == 0)
 		return -EINVAL;
 
-	err = drmModeSetCrtc(screen->fd, screen->crtc, fb->id, 0, 0,
-			     &screen->connector, 1, &screen->mode);
+	interval = screen->schedule.interval;
+	margin = screen->schedule.margin * 1000ull;
+
+	err = drmCrtcGetSequence(screen->fd, screen->crtc, &sequence, &ns);
 	if (err < 0)
 		return -errno;
 
-	screen->current ^= 1;
+	if (screen->schedule.target == 0)
+		screen->schedule.target = sequence;
+
+	screen->schedule.target += interval;
+
+	while (screen->schedule.target <= sequence) {
+		screen->schedule.target += interval;
+		screen->schedule.missed++;
+	}
+
+	/*
+	 * Re-anchor to the last vertical blank before the wakeup time so that
+	 * the deadline is derived from a fresh timestamp rather than being
+	 * extrapolated across the whole interval.
+	 */
+	anchor = screen->schedule.target - 1 - margin / screen->schedule.period;
+
+	if (anchor > sequence) {
+		err = drmCrtcQueueSequence(screen->fd, screen->crtc, 0, anchor,
+					   NULL, (uintptr_t)screen);
+		if (err < 0)
+			return -errno;
+
+		screen->schedule.queued = true;
+
+		while (screen->schedule.queued) {
+			err = drm_kms_screen_poll(screen, NULL);
+			if (err < 0)
+				return err;
+		}
+
+		sequence = screen->schedule.sequence;
+		ns = screen->schedule.timestamp;
+	}
+
+	deadline = ns + (screen->schedule.target - sequence) *
+		   screen->schedule.period;
+
+	if (deadline > margin) {
+		err = drm_kms_screen_dispatch_until(screen, deadline - margin);
+		if (err < 0)
+			return err;
+	}
+
+	if (sequencep)
+		*sequencep = screen->schedule.target;
 
 	return 0;
 }
 
-int drm_kms_screen_swap_to(struct drm_kms_screen *screen,
-			   struct drm_kms_surface *surface)
+/*
+ * Waits until all queued frames have been flipped to and the last page-flip
+ * has completed.
+ */
+int drm_kms_screen_wait_flip(struct drm_kms_screen *screen)
 {
 	int err;
 
-	if (!screen || !surface)
+	if (!screen)
 		return -EINVAL;
 
-	err = drmModeSetCrtc(screen->fd, screen->crtc, surface->id, 0, 0,
-			     &screen->connector, 1, &screen->mode);
-	if (err < 0)
-		return -errno;
+	while (screen->pending || screen->num_queued > 0) {
+		err = drm_kms_screen_dispatch(screen, -1);
+		if (err < 0)
+			return err;
+	}
 
 	return 0;
 }
 
-int drm_kms_screen_flip(struct drm_kms_screen *screen, void *data)
+/*
+ * Returns the next swapchain buffer that is neither being scanned out nor
+ * waiting for a page-flip to complete, blocking until one becomes available.
+ * The returned buffer becomes the one used by drm_kms_screen_flip().
+ */
+int drm_kms_screen_acquire(struct drm_kms_screen *screen,
+			   struct drm_kms_surface **surfacep)
 {
-	struct drm_kms_surface *fb = screen->fb[screen->current];
 	int err;
 
-	if (!screen)
+	while (true) {
+		err = drm_kms_screen_try_acquire(screen, surfacep);
+		if (err != -EAGAIN)
+			return err;
+
+		err = drm_kms_screen_dispatch(screen, -1);
+		if (err < 0)
+			return err;
+	}
+}
+
+/*
+ * Like drm_kms_screen_acquire(), but returns -EAGAIN instead of blocking if
+ * no swapchain buffer is available. In mailbox mode a buffer that is queued
+ * behind the pending flip is reclaimed, and its frame dropped, if no other
+ * buffer is free.
+ */
+int drm_kms_screen_try_acquire(struct drm_kms_screen *screen,
+			       struct drm_kms_surface **surfacep)
+{
+	struct drm_kms_surface *fb;
+	unsigned int i, index;
+
+	if (!screen || !surfacep)
 		return -EINVAL;
 
-	err = drmModePageFlip(screen->fd, screen->crtc, fb->id,
-			      DRM_MODE_PAGE_FLIP_EVENT, data);
-	if (err < 0)
+	for (i = 0; i < screen->num_buffers; i++) {
+		index = (screen->current + i) % screen->num_buffers;
+		fb = screen->fb[index];
+
+		if (fb->state == DRM_KMS_SURFACE_FREE) {
+			screen->current = index;
+			*surfacep = fb;
+			return 0;
+		}
+	}
+
+	if (screen->present_mode != DRM_KMS_PRESENT_MODE_MAILBOX)
+		return -EAGAIN;
+
+	for (i = 0; i < screen->num_buffers; i++) {
+		index = (screen->current + i) % screen->num_buffers;
+		fb = screen->fb[index];
+
+		if (fb->state == DRM_KMS_SURFACE_QUEUED &&
+		    drm_kms_screen_unqueue(screen, fb)) {
+			fb->state = DRM_KMS_SURFACE_FREE;
+
+			if (screen->stats)
+				screen->stats->dropped++;
+
+			screen->current = index;
+			*surfacep = fb;
+			return 0;
+		}
+	}
+
+	return -EAGAIN;
+}
+
+static int drm_kms_screen_parse_in_formats(struct drm_kms_screen *screen,
+					   uint32_t blob_id, uint32_t format,
+					   uint64_t *modifiers,
+					   unsigned int *countp)
+{
+	const struct drm_format_modifier_blob *header;
+	const struct drm_format_modifier *mods;
+	drmModePropertyBlobPtr blob;
+	const uint32_t *formats;
+	unsigned int count = 0;
+	uint32_t i, index;
+
+	blob = drmModeGetPropertyBlob(screen->fd, blob_id);
+	if (!blob)
 		return -errno;
 
-	screen->current ^= 1;
+	header = blob->data;
+	formats = blob->data + header->formats_offset;
+	mods = blob->data + header->modifiers_offset;
+
+	for (index = 0; index < header->count_formats; index++)
+		if (formats[index] == format)
+			break;
+
+	if (index == header->count_formats) {
+		drmModeFreePropertyBlob(blob);
+		return -EINVAL;
+	}
+
+	/* each entry covers a window of 64 formats starting at offset */
+	for (i = 0; i < header->count_modifiers; i++) {
+		if (index < mods[i].offset || index >= mods[i].offset + 64)
+			continue;
+
+		if ((mods[i].formats & (1ull << (index - mods[i].offset))) == 0)
+			continue;
+
+		if (modifiers)
+			modifiers[count] = mods[i].modifier;
+
+		count++;
+	}
+
+	drmModeFreePropertyBlob(blob);
+	*countp = count;
 
 	return 0;
 }
 
-int drm_kms_screen_flip_to(struct drm_kms_screen *screen,
-			   struct drm_kms_surface *surface, void *data)
+/*
+ * Returns the list of modifiers that the screen's primary plane supports for
+ * the given format, as advertised by its IN_FORMATS property. If the driver
+ * doesn't support modifiers, the list contains only DRM_FORMAT_MOD_LINEAR.
+ * The caller is responsible for freeing the list.
+ */
+int drm_kms_screen_get_modifiers(struct drm_kms_screen *screen,
+				 uint32_t format, uint64_t **modifiersp,
+				 unsigned int *countp)
 {
+	drmModeObjectPropertiesPtr props;
+	unsigned int count = 0;
+	uint64_t *modifiers;
+	uint64_t value = 0;
 	int err;
 
-	if (!screen || !surface)
+	if (!screen || !modifiersp || !countp)
 		return -EINVAL;
 
-	err = drmModePageFlip(screen->fd, screen->crtc, surface->id,
-			      DRM_MODE_PAGE_FLIP_EVENT, data);
-	if (err < 0)
-		return -errno;
+	value = screen->modifiers;
+
+	/* the primary plane is only known up front with atomic modesetting */
+	if (value && !screen->atomic.plane) {
+		drmSetClientCap(screen->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+
+		if (drm_kms_screen_find_primary_plane(screen) < 0)
+			value = 0;
+	}
+
+	if (value) {
+		props = drmModeObjectGetProperties(screen->fd,
+						   screen->atomic.plane,
+						   DRM_MODE_OBJECT_PLANE);
+		if (!props)
+			return -errno;
+
+		err = drm_kms_object_find_property(screen->fd, props,
+						   "IN_FORMATS", NULL, &value);
+		drmModeFreeObjectProperties(props);
+
+		if (err == 0)
+			err = drm_kms_screen_parse_in_formats(screen, value,
+							      format, NULL,
+							      &count);
+
+		if (err < 0)
+			count = 0;
+	}
+
+	modifiers = calloc(count ?: 1, sizeof(*modifiers));
+	if (!modifiers)
+		return -ENOMEM;
+
+	if (count > 0) {
+		err = drm_kms_screen_parse_in_formats(screen, value, format,
+						      modifiers, &count);
+		if (err < 0) {
+			free(modifiers);
+			return err;
+		}
+	} else {
+		modifiers[0] = DRM_FORMAT_MOD_LINEAR;
+		count = 1;
+	}
+
+	*modifiersp = modifiers;
+	*countp = count;
 
 	return 0;
 }
 
+/*
+ * Imports DMA-BUFs as a framebuffer. Surfaces are cached by the GEM handles
+ * of their DMA-BUFs, which unlike inode numbers are unique on all kernels,
+ * so importing a buffer that was seen before returns the existing surface
+ * without creating another framebuffer. Every import must be balanced by a
+ * call to drm_kms_surface_free(). The cache keeps its own reference until
+ * the buffer is evicted with drm_kms_screen_evict_import() or the screen is
+ * freed.
+ */
 int drm_kms_screen_import_surface(struct drm_kms_screen *screen,
 				  struct drm_kms_surface **surfacep,
 				  const struct drm_kms_import *args)
 {
-	struct drm_kms_surface *surface;
-	uint32_t handle, offset = 0;
+	uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	uint64_t modifiers[4] = { 0 }, modifier = args->planes[0].modifier;
+	struct drm_kms_surface **imports, *surface = NULL;
+	const struct drm_format *info;
+	unsigned int num_planes = 1, i;
 	int err;
 
+	info = drm_format_find(args->format);
+	if (info)
+		num_planes = info->num_planes;
+
+	if (args->num_planes > 0)
+		num_planes = args->num_planes;
+
+	if (num_planes > DRM_KMS_IMPORT_MAX_PLANES)
+		return -EINVAL;
+
+	/* all planes of a framebuffer must share the same layout */
+	for (i = 0; i < num_planes; i++)
+		if (args->planes[i].modifier != modifier)
+			return -EINVAL;
+
+	for (i = 0; i < num_planes; i++) {
+		err = drm_kms_screen_get_handle(screen, args->planes[i].fd,
+						&handles[i]);
+		if (err < 0)
+			goto put;
+	}
+
+	surface = drm_kms_screen_find_import(screen, args, handles, num_planes);
+	if (surface) {
+		for (i = 0; i < num_planes; i++)
+			drm_kms_screen_put_handle(screen, handles[i]);
+
+		surface->import.refcount++;
+		*surfacep = surface;
+		return 0;
+	}
+
+	imports = realloc(screen->imports,
+			  (screen->num_imports + 1) * sizeof(*imports));
+	if (!imports) {
+		err = -ENOMEM;
+		goto put;
+	}
+
+	screen->imports = imports;
+
 	surface = calloc(1, sizeof(*surface));
-	if (!surface)
-		return -ENOMEM;
+	if (!surface) {
+		err = -ENOMEM;
+		goto put;
+	}
 
 	surface->screen = screen;
 	surface->width = args->width;
 	surface->height = args->height;
 	surface->format = args->format;
+	surface->modifier = modifier;
+	surface->fence = -1;
+	surface->release = -1;
+
+	for (i = 0; i < num_planes; i++) {
+		pitches[i] = args->planes[i].pitch;
+		offsets[i] = args->planes[i].offset;
+		modifiers[i] = modifier;
+
+		surface->import.handles[i] = handles[i];
+		surface->import.offsets[i] = offsets[i];
+		surface->import.pitches[i] = pitches[i];
+	}
 
-	err = drmPrimeFDToHandle(screen->fd, args->fd, &handle);
+	surface->import.num_planes = num_planes;
+
+	/*
+	 * Linear and implicit (invalid) modifiers go through the plain
+	 * interface so that drivers without modifier support keep working.
+	 * Such drivers can still be handed non-linear buffers if GBM fell
+	 * back to allocating with the default layout, which the driver then
+	 * recovers from the buffer object itself.
+	 */
+	if (modifier != DRM_FORMAT_MOD_LINEAR &&
+	    modifier != DRM_FORMAT_MOD_INVALID && screen->modifiers)
+		err = drmModeAddFB2WithModifiers(screen->fd, args->width,
+						 args->height, args->format,
+						 handles, pitches, offsets,
+						 modifiers, &surface->id,
+						 DRM_MODE_FB_MODIFIERS);
+	else
+		err = drmModeAddFB2(screen->fd, args->width, args->height,
+				    args->format, handles, pitches, offsets,
+				    &surface->id, 0);
 	if (err < 0) {
-		free(surface);
-		return -errno;
+		err = -errno;
+		goto put;
 	}
 
-	err = drmModeAddFB2(screen->fd, args->width, args->height,
-			    args->format, &handle, &args->pitch, &offset,
-			    &surface->id, 0);
-	if (err < 0) {
-		/* TODO close handle */
-		free(surface);
+	/* one reference for the caller, one for the cache */
+	surface->import.refcount = 2;
+	screen->imports[screen->num_imports++] = surface;
+
+	*surfacep = surface;
+
+	return 0;
+
+put:
+	while (i--)
+		drm_kms_screen_put_handle(screen, handles[i]);
+
+	free(surface);
+	return err;
+}
+
+/*
+ * Drops the cache's reference to surfaces imported from the given DMA-BUF.
+ * This should be called when the producer destroys the buffer, so that its
+ * framebuffer and GEM handle don't keep the memory alive.
+ */
+int drm_kms_screen_evict_import(struct drm_kms_screen *screen, int fd)
+{
+	struct drm_kms_surface *surface;
+	struct drm_gem_close args;
+	uint32_t handle;
+	unsigned int i, j;
+	int err;
+
+	if (!screen)
+		return -EINVAL;
+
+	err = drmPrimeFDToHandle(screen->fd, fd, &handle);
+	if (err < 0)
 		return -errno;
+
+	for (i = 0; i < screen->num_handles; i++)
+		if (screen->handles[i].handle == handle)
+			break;
+
+	/* the buffer was never imported, so the lookup created the handle */
+	if (i == screen->num_handles) {
+		memset(&args, 0, sizeof(args));
+		args.handle = handle;
+
+		drmIoctl(screen->fd, DRM_IOCTL_GEM_CLOSE, &args);
+		return 0;
 	}
 
-	*surfacep = surface;
+	i = 0;
+
+	while (i < screen->num_imports) {
+		surface = screen->imports[i];
+
+		for (j = 0; j < surface->import.num_planes; j++)
+			if (surface->import.handles[j] == handle)
+				break;
+
+		if (j == surface->import.num_planes) {
+			i++;
+			continue;
+		}
+
+		/*
+		 * Users that still hold a reference keep the surface alive,
+		 * and so does the display until a flip replaces it.
+		 */
+		screen->imports[i] = screen->imports[--screen->num_imports];
+		drm_kms_surface_free(surface);
+	}
 
 	return 0;
 }
@@ -574,3 +3341,187 @@ void drm_kms_lut_free(struct drm_kms_lut *lut)
 	free(lut->entries);
 	free(lut);
 }
+
+static int drm_kms_compare_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+static double drm_kms_percentile(const uint64_t *values, unsigned int count,
+				 unsigned int percent)
+{
+	unsigned int index = (count * percent + 99) / 100;
+
+	return values[index ? index - 1 : 0] / 1000000.0;
+}
+
+/*
+ * Computes frame-time statistics from the flip timestamps recorded for the
+ * screen, which must have been created with DRM_KMS_SCREEN_STATS.
+ */
+int drm_kms_screen_get_stats(struct drm_kms_screen *screen,
+			     struct drm_kms_stats_summary *summary)
+{
+	const struct drm_kms_stats *stats;
+	double mean = 0, variance = 0;
+	uint64_t *intervals, latency = 0;
+	unsigned int i, count;
+
+	if (!screen || !screen->stats || !summary)
+		return -EINVAL;
+
+	stats = screen->stats;
+
+	memset(summary, 0, sizeof(*summary));
+	summary->frames = stats->num_frames;
+	summary->missed = stats->missed;
+	summary->dropped = stats->dropped;
+	summary->period = drm_kms_mode_get_period(&screen->mode) / 1000000.0;
+
+	if (stats->num_frames < 2)
+		return 0;
+
+	count = stats->num_frames - 1;
+
+	intervals = malloc(count * sizeof(*intervals));
+	if (!intervals)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		const struct drm_kms_frame_stats *frame = &stats->frames[i + 1];
+
+		intervals[i] = frame->timestamp - frame[-1].timestamp;
+		latency += frame->complete - frame->submit;
+		mean += intervals[i];
+	}
+
+	mean /= count;
+
+	for (i = 0; i < count; i++)
+		variance += (intervals[i] - mean) * (intervals[i] - mean);
+
+	qsort(intervals, count, sizeof(*intervals), drm_kms_compare_u64);
+
+	summary->mean = mean / 1000000.0;
+	summary->jitter = sqrt(variance / count) / 1000000.0;
+	summary->p50 = drm_kms_percentile(intervals, count, 50);
+	summary->p90 = drm_kms_percentile(intervals, count, 90);
+	summary->p99 = drm_kms_percentile(intervals, count, 99);
+	summary->max = intervals[count - 1] / 1000000.0;
+	summary->latency = latency / 1000000.0 / count;
+
+	free(intervals);
+
+	return 0;
+}
+
+void drm_kms_screen_print_stats(struct drm_kms_screen *screen, FILE *fp)
+{
+	struct drm_kms_stats_summary summary;
+
+	if (screen && screen->pool.max_size > 0)
+		fprintf(fp, "buffer pool: %lu hits, %lu misses, %llu bytes retained\n",
+			screen->pool.hits, screen->pool.misses,
+			(unsigned long long)screen->pool.size);
+
+	if (drm_kms_screen_get_stats(screen, &summary) < 0)
+		return;
+
+	fprintf(fp, "frames: %u, missed vblanks: %u, dropped: %u\n",
+		summary.frames, summary.missed, summary.dropped);
+	fprintf(fp, "refresh: %.3f ms, frame time: %.3f ms (jitter %.3f ms)\n",
+		summary.period, summary.mean, summary.jitter);
+	fprintf(fp, "percentiles: 50%% %.3f ms, 90%% %.3f ms, 99%% %.3f ms, max %.3f ms\n",
+		summary.p50, summary.p90, summary.p99, summary.max);
+	fprintf(fp, "submit-to-completion: %.3f ms\n", summary.latency);
+}
+
+static void drm_kms_stats_write_csv(const struct drm_kms_stats *stats,
+				    FILE *fp)
+{
+	unsigned int i;
+
+	fprintf(fp, "frame,sequence,timestamp,submit,complete,missed\n");
+
+	for (i = 0; i < stats->num_frames; i++) {
+		const struct drm_kms_frame_stats *frame = &stats->frames[i];
+
+		fprintf(fp, "%u,%u,%llu,%llu,%llu,%u\n", i, frame->sequence,
+			(unsigned long long)frame->timestamp,
+			(unsigned long long)frame->submit,
+			(unsigned long long)frame->complete, frame->missed);
+	}
+}
+
+static void drm_kms_stats_write_json(const struct drm_kms_stats *stats,
+				     const struct drm_kms_stats_summary *summary,
+				     FILE *fp)
+{
+	unsigned int i;
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"summary\": {\n");
+	fprintf(fp, "    \"frames\": %u,\n", summary->frames);
+	fprintf(fp, "    \"missed\": %u,\n", summary->missed);
+	fprintf(fp, "    \"dropped\": %u,\n", summary->dropped);
+	fprintf(fp, "    \"period\": %.6f,\n", summary->period);
+	fprintf(fp, "    \"mean\": %.6f,\n", summary->mean);
+	fprintf(fp, "    \"jitter\": %.6f,\n", summary->jitter);
+	fprintf(fp, "    \"p50\": %.6f,\n", summary->p50);
+	fprintf(fp, "    \"p90\": %.6f,\n", summary->p90);
+	fprintf(fp, "    \"p99\": %.6f,\n", summary->p99);
+	fprintf(fp, "    \"max\": %.6f,\n", summary->max);
+	fprintf(fp, "    \"latency\": %.6f\n", summary->latency);
+	fprintf(fp, "  },\n");
+	fprintf(fp, "  \"frames\": [\n");
+
+	for (i = 0; i < stats->num_frames; i++) {
+		const struct drm_kms_frame_stats *frame = &stats->frames[i];
+
+		fprintf(fp, "    { \"sequence\": %u, \"timestamp\": %llu, "
+			"\"submit\": %llu, \"complete\": %llu, "
+			"\"missed\": %u }%s\n", frame->sequence,
+			(unsigned long long)frame->timestamp,
+			(unsigned long long)frame->submit,
+			(unsigned long long)frame->complete, frame->missed,
+			(i + 1 < stats->num_frames) ? "," : "");
+	}
+
+	fprintf(fp, "  ]\n");
+	fprintf(fp, "}\n");
+}
+
+/*
+ * Writes the per-frame statistics to a file, in JSON format if the filename
+ * ends in ".json" and as CSV otherwise.
+ */
+int drm_kms_screen_save_stats(struct drm_kms_screen *screen,
+			      const char *filename)
+{
+	struct drm_kms_stats_summary summary;
+	const char *ext;
+	int err = 0;
+	FILE *fp;
+
+	err = drm_kms_screen_get_stats(screen, &summary);
+	if (err < 0)
+		return err;
+
+	fp = fopen(filename, "w");
+	if (!fp)
+		return -errno;
+
+	ext = strrchr(filename, '.');
+
+	if (ext && strcmp(ext, ".json") == 0)
+		drm_kms_stats_write_json(screen->stats, &summary, fp);
+	else
+		drm_kms_stats_write_csv(screen->stats, fp);
+
+	if (fclose(fp) != 0)
+		err = -errno;
+
+	return err;
+}
@@ -24,20 +24,24 @@
 #ifndef DRM_KMS_H
 #define DRM_KMS_H 1
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include "drm-map.h"
+
 struct drm_kms_bo {
 	int fd;
 	uint32_t handle;
-	uint32_t size;
+	uint64_t size;
 	void *ptr;
-	int map_count;
 	uint32_t pitch;
+	struct drm_map map;
 };
 
 int drm_kms_bo_create(struct drm_kms_bo **bop, int fd, unsigned int width,
@@ -48,6 +52,22 @@ int drm_kms_bo_unmap(struct drm_kms_bo *bo);
 
 struct drm_kms_screen;
 
+#define DRM_KMS_IMPORT_MAX_PLANES 4
+
+struct drm_kms_rect {
+	int x;
+	int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+enum drm_kms_surface_state {
+	DRM_KMS_SURFACE_FREE,
+	DRM_KMS_SURFACE_QUEUED,
+	DRM_KMS_SURFACE_PENDING,
+	DRM_KMS_SURFACE_SCANOUT,
+};
+
 struct drm_kms_surface {
 	struct drm_kms_screen *screen;
 	struct drm_kms_bo *bo;
@@ -55,23 +75,210 @@ struct drm_kms_surface {
 	unsigned int height;
 	unsigned int bpp;
 	uint32_t format;
+	uint64_t modifier;
 	uint32_t id;
+
+	enum drm_kms_surface_state state;
+	uint64_t submitted;
+	void *data;
+
+	/* freed while still in use, released once the display is done */
+	bool freed;
+
+	/*
+	 * Explicit synchronization (sync_file FDs, -1 if unused): the display
+	 * engine waits for fence to signal before scanning out the surface,
+	 * and release signals once the surface is no longer scanned out.
+	 */
+	int fence;
+	int release;
+
+	/*
+	 * Region that changed since the surface was last presented. It is
+	 * consumed by the next flip to the surface; none means all of it.
+	 */
+	struct {
+		struct drm_kms_rect *rects;
+		unsigned int count;
+	} damage;
+
+	/*
+	 * Cached copy of the buffer, with the same layout, that is handed out
+	 * by drm_kms_surface_lock() on screens created with the shadow flag.
+	 */
+	void *shadow;
+
+	/* identifies imported surfaces in the screen's import cache */
+	struct {
+		uint32_t handles[DRM_KMS_IMPORT_MAX_PLANES];
+		unsigned int offsets[DRM_KMS_IMPORT_MAX_PLANES];
+		unsigned int pitches[DRM_KMS_IMPORT_MAX_PLANES];
+		unsigned int num_planes;
+		unsigned int refcount;
+	} import;
 };
 
 int drm_kms_surface_create(struct drm_kms_surface **surfacep,
 			   struct drm_kms_screen *screen, unsigned int width,
-			   unsigned int height, unsigned int bpp);
+			   unsigned int height, uint32_t format);
 int drm_kms_surface_free(struct drm_kms_surface *surface);
 int drm_kms_surface_lock(struct drm_kms_surface *surface, void **ptr);
 int drm_kms_surface_unlock(struct drm_kms_surface *surface);
+void drm_kms_surface_set_fence(struct drm_kms_surface *surface, int fence);
+int drm_kms_surface_take_release(struct drm_kms_surface *surface);
+int drm_kms_surface_set_damage(struct drm_kms_surface *surface,
+			       const struct drm_kms_rect *rects,
+			       unsigned int count);
+
+int drm_kms_fence_wait(int fence, int timeout);
 
 #define DRM_KMS_SCREEN_FULLSCREEN (1 << 0)
+#define DRM_KMS_SCREEN_LEGACY (1 << 1)
+#define DRM_KMS_SCREEN_STATS (1 << 2)
+#define DRM_KMS_SCREEN_SPAN (1 << 3)
+#define DRM_KMS_SCREEN_SHADOW (1 << 4)
+
+#define DRM_KMS_SCREEN_MIN_BUFFERS 2
+#define DRM_KMS_SCREEN_MAX_BUFFERS 8
+
+enum drm_kms_present_mode {
+	/* every frame is displayed, in order, one per vertical blank */
+	DRM_KMS_PRESENT_MODE_FIFO,
+	/* a newer frame replaces the one waiting for the next vertical blank */
+	DRM_KMS_PRESENT_MODE_MAILBOX,
+	/*
+	 * frames are never queued, presenting blocks until the previous flip
+	 * has completed
+	 */
+	DRM_KMS_PRESENT_MODE_IMMEDIATE,
+	/* like immediate, but without waiting for vertical blank (tears) */
+	DRM_KMS_PRESENT_MODE_ASYNC,
+};
+
+/* timestamps are CLOCK_MONOTONIC, in nanoseconds */
+struct drm_kms_frame_stats {
+	uint64_t submit;
+	uint64_t complete;
+	uint64_t timestamp;
+	uint32_t sequence;
+	unsigned int missed;
+};
+
+struct drm_kms_stats {
+	struct drm_kms_frame_stats *frames;
+	unsigned int num_frames;
+	unsigned int size;
+	unsigned int missed;
+	unsigned int dropped;
+};
+
+/* durations are in milliseconds */
+struct drm_kms_stats_summary {
+	unsigned int frames;
+	unsigned int missed;
+	unsigned int dropped;
+	double period;
+	double mean;
+	double jitter;
+	double p50;
+	double p90;
+	double p99;
+	double max;
+	double latency;
+};
+
+struct drm_kms_plane_props {
+	uint32_t fb_id;
+	uint32_t crtc_id;
+	uint32_t src_x;
+	uint32_t src_y;
+	uint32_t src_w;
+	uint32_t src_h;
+	uint32_t crtc_x;
+	uint32_t crtc_y;
+	uint32_t crtc_w;
+	uint32_t crtc_h;
+	uint32_t zpos;
+	uint32_t in_fence_fd;
+	uint32_t fb_damage_clips;
+};
+
+struct drm_kms_plane {
+	struct drm_kms_screen *screen;
+	uint32_t id;
+	uint32_t *formats;
+	unsigned int num_formats;
+	struct drm_kms_plane_props props;
+
+	bool zpos_mutable;
+	uint64_t zpos_min;
+	uint64_t zpos_max;
+	uint64_t zpos;
+
+	struct drm_kms_surface *surface;
+	struct drm_kms_rect src;
+	struct drm_kms_rect dst;
+	bool dirty;
+};
+
+bool drm_kms_plane_supports_format(const struct drm_kms_plane *plane,
+				   uint32_t format);
+int drm_kms_plane_attach(struct drm_kms_plane *plane,
+			 struct drm_kms_surface *surface,
+			 const struct drm_kms_rect *src,
+			 const struct drm_kms_rect *dst, int zpos);
+int drm_kms_plane_detach(struct drm_kms_plane *plane);
+
+struct drm_kms_cursor {
+	struct drm_kms_screen *screen;
+	struct drm_kms_bo *bo;
+	unsigned int width;
+	unsigned int height;
+	int hot_x;
+	int hot_y;
+	int x;
+	int y;
+	bool visible;
+};
+
+int drm_kms_cursor_create(struct drm_kms_cursor **cursorp,
+			  struct drm_kms_screen *screen, const uint32_t *image,
+			  unsigned int width, unsigned int height,
+			  int hot_x, int hot_y);
+void drm_kms_cursor_free(struct drm_kms_cursor *cursor);
+int drm_kms_cursor_show(struct drm_kms_cursor *cursor);
+int drm_kms_cursor_hide(struct drm_kms_cursor *cursor);
+int drm_kms_cursor_move(struct drm_kms_cursor *cursor, int x, int y);
+
+struct drm_kms_handle {
+	uint32_t handle;
+	unsigned int refcount;
+};
+
+/*
+ * Freed surfaces are kept, mapped and with their framebuffers registered,
+ * and handed out again to requests for the same size and format.
+ */
+struct drm_kms_pool {
+	struct drm_kms_surface **surfaces;
+	unsigned int num_surfaces;
+	uint64_t size; /* bytes currently retained */
+	uint64_t max_size; /* 0 disables the pool */
+	unsigned long hits;
+	unsigned long misses;
+};
 
 struct drm_kms_screen_args {
 	unsigned int width;
 	unsigned int height;
 	uint32_t format;
 	unsigned long flags;
+	unsigned int num_buffers; /* 0 selects double-buffering */
+	enum drm_kms_present_mode present_mode;
+	unsigned int columns; /* outputs per row when spanning, 0 for all */
+	unsigned int render_width; /* 0 renders at the screen size */
+	unsigned int render_height;
+	uint64_t pool_size; /* bytes of freed surfaces to retain, 0 for none */
 };
 
 struct drm_kms_screen {
@@ -82,9 +289,87 @@ struct drm_kms_screen {
 	unsigned int pipe;
 	unsigned int width;
 	unsigned int height;
-	struct drm_kms_surface *fb[2];
+	unsigned int x;
+	unsigned int y;
+
+	/*
+	 * Size that clients should render at. If this is smaller than the
+	 * mode, either the display engine scales the framebuffers up (the
+	 * screen's framebuffers are render-sized) or, if scaled is false,
+	 * clients need to scale up to the screen size themselves.
+	 */
+	struct {
+		unsigned int width;
+		unsigned int height;
+		bool scaled;
+	} render;
+
+	struct drm_kms_surface *fb[DRM_KMS_SCREEN_MAX_BUFFERS];
+	unsigned int num_buffers;
 	unsigned int current;
+	bool master;
 	int fd;
+
+	enum drm_kms_present_mode present_mode;
+	bool async;
+	bool modifiers; /* framebuffers can have explicit modifiers */
+	drmEventContext events;
+	struct drm_kms_surface *scanout;
+	struct drm_kms_surface *pending;
+	struct drm_kms_surface *queue[DRM_KMS_SCREEN_MAX_BUFFERS];
+	unsigned int num_queued;
+	unsigned int num_flips;
+
+	/* additional outputs scanning out of this screen's buffers */
+	struct drm_kms_screen **span;
+	unsigned int num_span;
+
+	/* overlay planes that can be used with the screen's CRTC */
+	struct drm_kms_plane *planes;
+	unsigned int num_planes;
+
+	/* imported surfaces and the GEM handles backing them */
+	struct drm_kms_surface **imports;
+	unsigned int num_imports;
+	struct drm_kms_handle *handles;
+	unsigned int num_handles;
+
+	struct drm_kms_pool pool;
+
+	/* CPU rendering goes to cached shadow buffers */
+	bool shadow;
+
+	struct {
+		unsigned int interval;
+		unsigned int margin; /* microseconds */
+		uint64_t period; /* nanoseconds */
+		uint64_t target;
+		uint64_t sequence;
+		uint64_t timestamp;
+		unsigned int missed;
+		bool queued;
+	} schedule;
+
+	struct drm_kms_stats *stats;
+
+	struct {
+		bool enabled;
+		bool async;
+		uint32_t plane;
+		uint32_t mode;
+
+		struct {
+			uint32_t active;
+			uint32_t mode_id;
+			uint32_t out_fence_ptr;
+		} crtc;
+
+		struct {
+			uint32_t crtc_id;
+		} connector;
+
+		struct drm_kms_plane_props primary;
+	} atomic;
 };
 
 int drm_kms_screen_create(struct drm_kms_screen **screenp, int fd);
@@ -102,17 +387,76 @@ int drm_kms_screen_flip(struct drm_kms_screen *screen, void *data);
 int drm_kms_screen_flip_to(struct drm_kms_screen *screen,
 			   struct drm_kms_surface *surface, void *data);
 
+#define DRM_KMS_FLIP_ASYNC (1 << 0)
+
+int drm_kms_screen_flip_to_with_flags(struct drm_kms_screen *screen,
+				      struct drm_kms_surface *surface,
+				      unsigned long flags, void *data);
+int drm_kms_screen_dispatch(struct drm_kms_screen *screen, int timeout);
+int drm_kms_screen_wait_flip(struct drm_kms_screen *screen);
+int drm_kms_screen_acquire(struct drm_kms_screen *screen,
+			   struct drm_kms_surface **surfacep);
+int drm_kms_screen_try_acquire(struct drm_kms_screen *screen,
+			       struct drm_kms_surface **surfacep);
+void drm_kms_screen_trim_pool(struct drm_kms_screen *screen, uint64_t size);
+int drm_kms_screen_enumerate_planes(struct drm_kms_screen *screen);
+int drm_kms_screen_update_planes(struct drm_kms_screen *screen);
+int drm_kms_screen_schedule(struct drm_kms_screen *screen,
+			    unsigned int interval, unsigned int margin);
+int drm_kms_screen_wait_frame(struct drm_kms_screen *screen,
+			      uint64_t *sequencep);
+
+int drm_kms_screen_get_stats(struct drm_kms_screen *screen,
+			     struct drm_kms_stats_summary *summary);
+void drm_kms_screen_print_stats(struct drm_kms_screen *screen, FILE *fp);
+int drm_kms_screen_save_stats(struct drm_kms_screen *screen,
+			      const char *filename);
+
+struct drm_kms_display {
+	struct drm_kms_screen **screens;
+	unsigned int num_screens;
+	int fd;
+};
+
+int drm_kms_display_create(struct drm_kms_display **displayp, int fd,
+			   const struct drm_kms_screen_args *args);
+void drm_kms_display_free(struct drm_kms_display *display);
+int drm_kms_display_open(struct drm_kms_display **displayp, const char *path,
+			 const struct drm_kms_screen_args *args);
+void drm_kms_display_close(struct drm_kms_display *display);
+int drm_kms_display_dispatch(struct drm_kms_display *display, int timeout);
+
+/*
+ * The number of planes is implied by the format. Planes may share a DMA-BUF,
+ * in which case they are told apart by their offsets. All planes must use
+ * the same modifier.
+ */
 struct drm_kms_import {
-	int fd; /* DMA-BUF */
 	unsigned int width;
 	unsigned int height;
-	unsigned int pitch;
 	uint32_t format;
+
+	/*
+	 * Number of memory planes, 0 for the number of planes of the format.
+	 * Compressed layouts can have auxiliary planes beyond those.
+	 */
+	unsigned int num_planes;
+
+	struct {
+		int fd; /* DMA-BUF */
+		unsigned int offset;
+		unsigned int pitch;
+		uint64_t modifier; /* DRM_FORMAT_MOD_LINEAR (0) by default */
+	} planes[DRM_KMS_IMPORT_MAX_PLANES];
 };
 
+int drm_kms_screen_get_modifiers(struct drm_kms_screen *screen,
+				 uint32_t format, uint64_t **modifiersp,
+				 unsigned int *countp);
 int drm_kms_screen_import_surface(struct drm_kms_screen *screen,
 				  struct drm_kms_surface **surfacep,
 				  const struct drm_kms_import *args);
+int drm_kms_screen_evict_import(struct drm_kms_screen *screen, int fd);
 
 struct drm_kms_lut_entry {
 	uint16_t red;
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2026 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/dma-buf.h>
+
+#include <gbm.h>
+#include <xf86drm.h>
+
+#include "drm-map.h"
+
+#ifndef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+struct dma_buf_export_sync_file {
+	__u32 flags;
+	__s32 fd;
+};
+
+struct dma_buf_import_sync_file {
+	__u32 flags;
+	__s32 fd;
+};
+
+#define DMA_BUF_IOCTL_EXPORT_SYNC_FILE \
+	_IOWR(DMA_BUF_BASE, 2, struct dma_buf_export_sync_file)
+#define DMA_BUF_IOCTL_IMPORT_SYNC_FILE \
+	_IOW(DMA_BUF_BASE, 3, struct dma_buf_import_sync_file)
+#endif
+
+void drm_map_init_dumb(struct drm_map *map, int fd, uint32_t handle,
+		       unsigned int width, unsigned int height,
+		       uint32_t stride, uint64_t size)
+{
+	memset(map, 0, sizeof(*map));
+	map->type = DRM_MAP_DUMB;
+	map->fd = fd;
+	map->handle = handle;
+	map->width = width;
+	map->height = height;
+	map->stride = stride;
+	map->size = size;
+}
+
+/*
+ * The pixel data starts offset bytes into the DMA-BUF. Everything up to its
+ * end is mapped, because mmap() needs a page-aligned offset.
+ */
+void drm_map_init_dmabuf(struct drm_map *map, int fd, unsigned int width,
+			 unsigned int height, uint32_t stride,
+			 uint64_t offset)
+{
+	memset(map, 0, sizeof(*map));
+	map->type = DRM_MAP_DMABUF;
+	map->fd = fd;
+	map->width = width;
+	map->height = height;
+	map->stride = stride;
+	map->offset = offset;
+	map->size = offset + (uint64_t)stride * height;
+}
+
+void drm_map_init_gbm(struct drm_map *map, struct gbm_bo *bo)
+{
+	memset(map, 0, sizeof(*map));
+	map->type = DRM_MAP_GBM;
+	map->fd = -1;
+	map->bo = bo;
+	map->width = gbm_bo_get_width(bo);
+	map->height = gbm_bo_get_height(bo);
+	map->stride = gbm_bo_get_stride(bo);
+	map->size = (uint64_t)map->stride * map->height;
+}
+
+void drm_map_release(struct drm_map *map)
+{
+	if (!map->ptr)
+		return;
+
+	if (map->type == DRM_MAP_GBM)
+		gbm_bo_unmap(map->bo, map->data);
+	else
+		munmap(map->ptr, map->size);
+
+	map->ptr = NULL;
+	map->data = NULL;
+	map->access = 0;
+	map->count = 0;
+}
+
+/* (re)creates a long-lived mapping that allows the given access */
+static int drm_map_mmap(struct drm_map *map, unsigned int access,
+			bool populate)
+{
+	int prot = 0, flags = MAP_SHARED;
+	off_t offset = 0;
+	void *ptr;
+	int err;
+
+	if (map->size > SIZE_MAX)
+		return -EFBIG;
+
+	if (map->type == DRM_MAP_DUMB) {
+		struct drm_mode_map_dumb args;
+
+		memset(&args, 0, sizeof(args));
+		args.handle = map->handle;
+
+		err = drmIoctl(map->fd, DRM_IOCTL_MODE_MAP_DUMB, &args);
+		if (err < 0)
+			return -errno;
+
+		offset = args.offset;
+	}
+
+	if (access & DRM_MAP_READ)
+		prot |= PROT_READ;
+
+	if (access & DRM_MAP_WRITE)
+		prot |= PROT_WRITE;
+
+	if (populate)
+		flags |= MAP_POPULATE;
+
+	ptr = mmap(NULL, map->size, prot, flags, map->fd, offset);
+	if (ptr == MAP_FAILED)
+		return -errno;
+
+	if (map->ptr)
+		munmap(map->ptr, map->size);
+
+	map->ptr = ptr;
+	map->access = access;
+
+	return 0;
+}
+
+static uint32_t drm_map_sync_flags(unsigned int access)
+{
+	uint32_t flags = 0;
+
+	if (access & DRM_MAP_READ)
+		flags |= DMA_BUF_SYNC_READ;
+
+	if (access & DRM_MAP_WRITE)
+		flags |= DMA_BUF_SYNC_WRITE;
+
+	return flags;
+}
+
+static int drm_map_sync(struct drm_map *map, unsigned int access,
+			uint64_t flags)
+{
+	struct dma_buf_sync args;
+	int err;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = flags | drm_map_sync_flags(access);
+
+	err = ioctl(map->fd, DMA_BUF_IOCTL_SYNC, &args);
+	if (err < 0)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Starts CPU access to rows y to y + height - 1 of the buffer, or to all rows
+ * from y on if height is 0. On success, *ptrp points to row y. Every call
+ * must be balanced by drm_map_end(). Returns -EBUSY if the access needs a
+ * mapping with more permissions while other accesses are outstanding.
+ */
+int drm_map_begin(struct drm_map *map, unsigned int flags, unsigned int y,
+		  unsigned int height, void **ptrp, uint32_t *stridep)
+{
+	unsigned int access = flags & DRM_MAP_RW;
+	uint32_t transfer = 0;
+	int err;
+
+	if (!access || y >= map->height)
+		return -EINVAL;
+
+	if (height == 0)
+		height = map->height - y;
+
+	if (height > map->height - y)
+		return -EINVAL;
+
+	if (map->type == DRM_MAP_GBM) {
+		/* each GBM mapping has its own staging data */
+		if (map->count > 0)
+			return -EBUSY;
+
+		if (access & DRM_MAP_READ)
+			transfer |= GBM_BO_TRANSFER_READ;
+
+		if (access & DRM_MAP_WRITE)
+			transfer |= GBM_BO_TRANSFER_WRITE;
+
+		/* only the rows that are accessed need to be transferred */
+		map->ptr = gbm_bo_map(map->bo, 0, y, map->width, height,
+				      transfer, &map->stride, &map->data);
+		if (!map->ptr)
+			return -ENOMEM;
+
+		*ptrp = map->ptr;
+	} else {
+		if ((map->access & access) != access) {
+			/* remapping would invalidate outstanding pointers */
+			if (map->count > 0)
+				return -EBUSY;
+
+			err = drm_map_mmap(map, map->access | access,
+					   flags & DRM_MAP_POPULATE);
+			if (err < 0)
+				return err;
+		}
+
+		if (map->type == DRM_MAP_DMABUF) {
+			err = drm_map_sync(map, access, DMA_BUF_SYNC_START);
+			if (err < 0)
+				return err;
+		}
+
+		*ptrp = map->ptr + map->offset + (uint64_t)y * map->stride;
+	}
+
+	if (stridep)
+		*stridep = map->stride;
+
+	map->pending |= access;
+	map->count++;
+
+	return 0;
+}
+
+int drm_map_end(struct drm_map *map)
+{
+	int err = 0;
+
+	if (map->count == 0)
+		return -EINVAL;
+
+	if (map->type == DRM_MAP_GBM) {
+		gbm_bo_unmap(map->bo, map->data);
+		map->data = NULL;
+		map->ptr = NULL;
+	} else if (map->type == DRM_MAP_DMABUF) {
+		err = drm_map_sync(map, map->pending, DMA_BUF_SYNC_END);
+	}
+
+	if (--map->count == 0)
+		map->pending = 0;
+
+	return err;
+}
+
+/*
+ * Returns a sync_file that signals once all device accesses conflicting with
+ * the given CPU access have completed: writes for DRM_MAP_READ, any access
+ * for DRM_MAP_WRITE. Waiting for it, for example with poll() in an event
+ * loop, keeps the cache maintenance in drm_map_begin() from blocking.
+ */
+int drm_map_export_fence(struct drm_map *map, unsigned int flags, int *fencep)
+{
+	struct dma_buf_export_sync_file args;
+	int err;
+
+	if (map->type != DRM_MAP_DMABUF)
+		return -EOPNOTSUPP;
+
+	if ((flags & DRM_MAP_RW) == 0)
+		return -EINVAL;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = drm_map_sync_flags(flags);
+	args.fd = -1;
+
+	err = ioctl(map->fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &args);
+	if (err < 0)
+		return -errno;
+
+	*fencep = args.fd;
+
+	return 0;
+}
+
+/*
+ * Attaches a sync_file to the DMA-BUF so that implicitly synchronized users,
+ * including drm_map_export_fence(), wait for it. With DRM_MAP_READ the fence
+ * marks the end of a read (only later writers wait for it), with
+ * DRM_MAP_WRITE the end of a write. The caller keeps ownership of the fence.
+ */
+int drm_map_import_fence(struct drm_map *map, unsigned int flags, int fence)
+{
+	struct dma_buf_import_sync_file args;
+	int err;
+
+	if (map->type != DRM_MAP_DMABUF)
+		return -EOPNOTSUPP;
+
+	if ((flags & DRM_MAP_RW) == 0)
+		return -EINVAL;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = drm_map_sync_flags(flags);
+	args.fd = fence;
+
+	err = ioctl(map->fd, DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &args);
+	if (err < 0)
+		return -errno;
+
+	return 0;
+}
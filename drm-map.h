@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2026 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DRM_MAP_H
+#define DRM_MAP_H 1
+
+#include <stdint.h>
+
+struct gbm_bo;
+
+#define DRM_MAP_READ     (1 << 0)
+#define DRM_MAP_WRITE    (1 << 1)
+#define DRM_MAP_RW       (DRM_MAP_READ | DRM_MAP_WRITE)
+#define DRM_MAP_POPULATE (1 << 2) /* prefault the pages of a new mapping */
+
+enum drm_map_type {
+	DRM_MAP_DUMB,
+	DRM_MAP_DMABUF,
+	DRM_MAP_GBM,
+};
+
+/*
+ * CPU mapping of a buffer. Dumb buffers and DMA-BUFs are mapped on first
+ * access and stay mapped until the mapping is released; accesses are only
+ * bracketed to keep caches coherent. GBM buffers are mapped for each access
+ * because gbm_bo_map() may go through a staging copy.
+ */
+struct drm_map {
+	enum drm_map_type type;
+	int fd; /* DRM device for dumb buffers, DMA-BUF otherwise */
+	uint32_t handle;
+	struct gbm_bo *bo;
+
+	unsigned int width;
+	unsigned int height;
+	uint32_t stride;
+	uint64_t offset; /* of the first row, within the mapping */
+	uint64_t size;
+
+	unsigned int access; /* access the mapping was created with */
+	unsigned int pending; /* access requested by outstanding begins */
+	unsigned int count;
+	void *ptr;
+	void *data;
+};
+
+void drm_map_init_dumb(struct drm_map *map, int fd, uint32_t handle,
+		       unsigned int width, unsigned int height,
+		       uint32_t stride, uint64_t size);
+void drm_map_init_dmabuf(struct drm_map *map, int fd, unsigned int width,
+			 unsigned int height, uint32_t stride,
+			 uint64_t offset);
+void drm_map_init_gbm(struct drm_map *map, struct gbm_bo *bo);
+void drm_map_release(struct drm_map *map);
+
+int drm_map_begin(struct drm_map *map, unsigned int flags, unsigned int y,
+		  unsigned int height, void **ptrp, uint32_t *stridep);
+int drm_map_end(struct drm_map *map);
+
+int drm_map_export_fence(struct drm_map *map, unsigned int flags,
+			 int *fencep);
+int drm_map_import_fence(struct drm_map *map, unsigned int flags, int fence);
+
+#endif /* DRM_MAP_H */
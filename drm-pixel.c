@@ -0,0 +1,361 @@
+/*
+ * Copyright (C) 2026 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "drm-pixel.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* non-temporal stores are issued in units of one cacheline */
+#define DRM_PIXEL_LINE 64
+
+static bool drm_pixel_scalar_supported(void)
+{
+	return true;
+}
+
+static void drm_pixel_fill_scalar(void *dst, uint32_t value, size_t count)
+{
+	uint32_t *pixels = dst;
+
+	while (count--)
+		*pixels++ = value;
+}
+
+static void drm_pixel_copy_scalar(void *dst, const void *src, size_t size)
+{
+	memcpy(dst, src, size);
+}
+
+/*
+ * Returns the number of 32-bit pixels to write before dst is aligned to a
+ * cacheline, limited to count.
+ */
+static size_t drm_pixel_head(const void *dst, size_t count)
+{
+	size_t head = (-(uintptr_t)dst & (DRM_PIXEL_LINE - 1)) / 4;
+
+	return head < count ? head : count;
+}
+
+/* returns the number of bytes to copy before dst is aligned to a cacheline */
+static size_t drm_pixel_copy_head(const void *dst, size_t size)
+{
+	size_t head = -(uintptr_t)dst & (DRM_PIXEL_LINE - 1);
+
+	return head < size ? head : size;
+}
+
+#if defined(__x86_64__)
+/* SSE2 is part of the x86-64 baseline */
+static bool drm_pixel_sse2_supported(void)
+{
+	return true;
+}
+
+static void drm_pixel_fill_sse2(void *dst, uint32_t value, size_t count)
+{
+	size_t head = drm_pixel_head(dst, count);
+	uint32_t *pixels = dst;
+	__m128i v;
+
+	drm_pixel_fill_scalar(pixels, value, head);
+	pixels += head;
+	count -= head;
+
+	v = _mm_set1_epi32(value);
+
+	for (; count >= 16; count -= 16, pixels += 16) {
+		_mm_stream_si128((__m128i *)pixels + 0, v);
+		_mm_stream_si128((__m128i *)pixels + 1, v);
+		_mm_stream_si128((__m128i *)pixels + 2, v);
+		_mm_stream_si128((__m128i *)pixels + 3, v);
+	}
+
+	drm_pixel_fill_scalar(pixels, value, count);
+}
+
+static void drm_pixel_copy_sse2(void *dst, const void *src, size_t size)
+{
+	size_t head = drm_pixel_copy_head(dst, size);
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	size -= head;
+
+	for (; size >= 64; size -= 64, d += 64, s += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)s + 0);
+		__m128i b = _mm_loadu_si128((const __m128i *)s + 1);
+		__m128i c = _mm_loadu_si128((const __m128i *)s + 2);
+		__m128i e = _mm_loadu_si128((const __m128i *)s + 3);
+
+		_mm_stream_si128((__m128i *)d + 0, a);
+		_mm_stream_si128((__m128i *)d + 1, b);
+		_mm_stream_si128((__m128i *)d + 2, c);
+		_mm_stream_si128((__m128i *)d + 3, e);
+	}
+
+	memcpy(d, s, size);
+}
+
+static void drm_pixel_flush_sse2(void)
+{
+	_mm_sfence();
+}
+
+static bool drm_pixel_avx2_supported(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void drm_pixel_fill_avx2(void *dst, uint32_t value, size_t count)
+{
+	size_t head = drm_pixel_head(dst, count);
+	uint32_t *pixels = dst;
+	__m256i v;
+
+	drm_pixel_fill_scalar(pixels, value, head);
+	pixels += head;
+	count -= head;
+
+	v = _mm256_set1_epi32(value);
+
+	for (; count >= 16; count -= 16, pixels += 16) {
+		_mm256_stream_si256((__m256i *)pixels + 0, v);
+		_mm256_stream_si256((__m256i *)pixels + 1, v);
+	}
+
+	drm_pixel_fill_scalar(pixels, value, count);
+}
+
+__attribute__((target("avx2")))
+static void drm_pixel_copy_avx2(void *dst, const void *src, size_t size)
+{
+	size_t head = drm_pixel_copy_head(dst, size);
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	size -= head;
+
+	for (; size >= 64; size -= 64, d += 64, s += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)s + 0);
+		__m256i b = _mm256_loadu_si256((const __m256i *)s + 1);
+
+		_mm256_stream_si256((__m256i *)d + 0, a);
+		_mm256_stream_si256((__m256i *)d + 1, b);
+	}
+
+	memcpy(d, s, size);
+}
+#elif defined(__aarch64__)
+/* Advanced SIMD is mandatory on AArch64 */
+static bool drm_pixel_neon_supported(void)
+{
+	return true;
+}
+
+/* STNP is a store pair with a hint that the data won't be read again soon */
+static void drm_pixel_fill_neon(void *dst, uint32_t value, size_t count)
+{
+	size_t head = drm_pixel_head(dst, count);
+	uint32_t *pixels = dst;
+	uint32x4_t v;
+
+	drm_pixel_fill_scalar(pixels, value, head);
+	pixels += head;
+	count -= head;
+
+	v = vdupq_n_u32(value);
+
+	for (; count >= 16; count -= 16, pixels += 16)
+		__asm__ volatile("stnp %q1, %q1, [%0]\n\t"
+				 "stnp %q1, %q1, [%0, #32]"
+				 : : "r"(pixels), "w"(v) : "memory");
+
+	drm_pixel_fill_scalar(pixels, value, count);
+}
+
+static void drm_pixel_copy_neon(void *dst, const void *src, size_t size)
+{
+	size_t head = drm_pixel_copy_head(dst, size);
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	size -= head;
+
+	for (; size >= 64; size -= 64, d += 64, s += 64)
+		__asm__ volatile("ldp q0, q1, [%1]\n\t"
+				 "ldp q2, q3, [%1, #32]\n\t"
+				 "stnp q0, q1, [%0]\n\t"
+				 "stnp q2, q3, [%0, #32]"
+				 : : "r"(d), "r"(s)
+				 : "v0", "v1", "v2", "v3", "memory");
+
+	memcpy(d, s, size);
+}
+
+static void drm_pixel_flush_neon(void)
+{
+	__asm__ volatile("dmb ishst" : : : "memory");
+}
+#endif
+
+/* ordered from most to least preferred */
+static const struct drm_pixel_kernels drm_pixel_kernels[] = {
+#if defined(__x86_64__)
+	{
+		.name = "avx2",
+		.supported = drm_pixel_avx2_supported,
+		.fill = drm_pixel_fill_avx2,
+		.copy = drm_pixel_copy_avx2,
+		.flush = drm_pixel_flush_sse2,
+	}, {
+		.name = "sse2",
+		.supported = drm_pixel_sse2_supported,
+		.fill = drm_pixel_fill_sse2,
+		.copy = drm_pixel_copy_sse2,
+		.flush = drm_pixel_flush_sse2,
+	},
+#elif defined(__aarch64__)
+	{
+		.name = "neon",
+		.supported = drm_pixel_neon_supported,
+		.fill = drm_pixel_fill_neon,
+		.copy = drm_pixel_copy_neon,
+		.flush = drm_pixel_flush_neon,
+	},
+#endif
+	{
+		.name = "scalar",
+		.supported = drm_pixel_scalar_supported,
+		.fill = drm_pixel_fill_scalar,
+		.copy = drm_pixel_copy_scalar,
+		.flush = NULL,
+	},
+};
+
+static const struct drm_pixel_kernels *drm_pixel_current;
+
+/* returns the index-th set of kernels that the CPU supports, or NULL */
+const struct drm_pixel_kernels *drm_pixel_enumerate(unsigned int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(drm_pixel_kernels); i++) {
+		if (!drm_pixel_kernels[i].supported())
+			continue;
+
+		if (index-- == 0)
+			return &drm_pixel_kernels[i];
+	}
+
+	return NULL;
+}
+
+/* the best supported kernels are selected on first use */
+const struct drm_pixel_kernels *drm_pixel_get_kernels(void)
+{
+	if (!drm_pixel_current)
+		drm_pixel_current = drm_pixel_enumerate(0);
+
+	return drm_pixel_current;
+}
+
+/* overrides the kernels used from now on, NULL selects the best again */
+void drm_pixel_set_kernels(const struct drm_pixel_kernels *kernels)
+{
+	drm_pixel_current = kernels;
+}
+
+/*
+ * Fills a rectangle of 32-bit pixels. Rows are pitch bytes apart, which may
+ * be more than width * 4.
+ */
+void drm_pixel_fill(void *dst, uint32_t pitch, unsigned int width,
+		    unsigned int height, uint32_t value)
+{
+	const struct drm_pixel_kernels *kernels = drm_pixel_get_kernels();
+	unsigned int y;
+
+	/* without padding between rows the whole rectangle is one run */
+	if (pitch == width * 4) {
+		kernels->fill(dst, value, (size_t)width * height);
+	} else {
+		for (y = 0; y < height; y++)
+			kernels->fill(dst + (size_t)y * pitch, value, width);
+	}
+
+	if (kernels->flush)
+		kernels->flush();
+}
+
+void drm_pixel_copy(void *dst, const void *src, size_t size)
+{
+	const struct drm_pixel_kernels *kernels = drm_pixel_get_kernels();
+
+	kernels->copy(dst, src, size);
+
+	if (kernels->flush)
+		kernels->flush();
+}
+
+/* copies height rows of size bytes each between buffers of any pitch */
+void drm_pixel_copy_rect(void *dst, uint32_t dst_pitch, const void *src,
+			 uint32_t src_pitch, unsigned int size,
+			 unsigned int height)
+{
+	const struct drm_pixel_kernels *kernels = drm_pixel_get_kernels();
+	unsigned int y;
+
+	if (dst_pitch == size && src_pitch == size) {
+		kernels->copy(dst, src, (size_t)size * height);
+	} else {
+		for (y = 0; y < height; y++)
+			kernels->copy(dst + (size_t)y * dst_pitch,
+				      src + (size_t)y * src_pitch, size);
+	}
+
+	if (kernels->flush)
+		kernels->flush();
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2026 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DRM_PIXEL_H
+#define DRM_PIXEL_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fill and copy routines for buffers that are mapped write-combined, such as
+ * dumb buffers and DMA-BUFs. The SIMD implementations write full cachelines
+ * with non-temporal stores so that the write-combining buffers are flushed
+ * as whole bursts and the CPU caches aren't polluted.
+ */
+struct drm_pixel_kernels {
+	const char *name;
+	bool (*supported)(void);
+	void (*fill)(void *dst, uint32_t value, size_t count);
+	void (*copy)(void *dst, const void *src, size_t size);
+	void (*flush)(void); /* orders non-temporal stores, may be NULL */
+};
+
+const struct drm_pixel_kernels *drm_pixel_enumerate(unsigned int index);
+const struct drm_pixel_kernels *drm_pixel_get_kernels(void);
+void drm_pixel_set_kernels(const struct drm_pixel_kernels *kernels);
+
+void drm_pixel_fill(void *dst, uint32_t pitch, unsigned int width,
+		    unsigned int height, uint32_t value);
+void drm_pixel_copy(void *dst, const void *src, size_t size);
+void drm_pixel_copy_rect(void *dst, uint32_t dst_pitch, const void *src,
+			 uint32_t src_pitch, unsigned int size,
+			 unsigned int height);
+
+#endif /* DRM_PIXEL_H */
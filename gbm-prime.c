@@ -1,5 +1,7 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -15,11 +17,241 @@
 #include <GLES2/gl2.h>
 #include <EGL/egl.h>
 
+#include "common.h"
 #include "drm-kms.h"
 #include "drm-gpu.h"
+#include "drm-pixel.h"
+
+#define NUM_BUFFERS 3
+
+struct buffer {
+	struct gbm_bo *bo;
+	int prime;
+	struct drm_kms_surface *fb;
+	struct drm_map map;
+};
+
+static int buffer_init(struct buffer *buffer, struct drm_kms_screen *screen,
+		       struct gbm_device *gbm, int fd, unsigned int width,
+		       unsigned int height)
+{
+	struct drm_kms_import import;
+	uint32_t handle;
+	int err;
+
+	buffer->bo = gbm_bo_create(gbm, width, height, DRM_FORMAT_XRGB8888,
+				   GBM_BO_USE_SCANOUT | GBM_BO_USE_LINEAR);
+	if (!buffer->bo)
+		return -ENOMEM;
+
+	handle = gbm_bo_get_handle(buffer->bo).u32;
+
+	err = drmPrimeHandleToFD(fd, handle, DRM_RDWR | DRM_CLOEXEC,
+				 &buffer->prime);
+	if (err < 0)
+		return -errno;
+
+	memset(&import, 0, sizeof(import));
+	import.width = width;
+	import.height = height;
+	import.format = DRM_FORMAT_XRGB8888;
+	import.planes[0].fd = buffer->prime;
+	import.planes[0].pitch = gbm_bo_get_stride(buffer->bo);
+	import.planes[0].offset = gbm_bo_get_offset(buffer->bo, 0);
+
+	err = drm_kms_screen_import_surface(screen, &buffer->fb, &import);
+	if (err < 0)
+		return err;
+
+	drm_map_init_dmabuf(&buffer->map, buffer->prime, width, height,
+			    gbm_bo_get_stride(buffer->bo),
+			    gbm_bo_get_offset(buffer->bo, 0));
+
+	return 0;
+}
+
+static void buffer_fini(struct buffer *buffer)
+{
+	drm_map_release(&buffer->map);
+	drm_kms_surface_free(buffer->fb);
+	close(buffer->prime);
+	gbm_bo_destroy(buffer->bo);
+}
+
+/*
+ * Processes page-flip events until the buffer has been replaced on screen.
+ * The display engine doesn't add its reads to the DMA-BUF's fences, so the
+ * release fence of the commit that replaced the buffer is attached to the
+ * DMA-BUF instead. Without release fences, or on kernels older than Linux
+ * 6.0 that can't import them, wait until the flip is done.
+ */
+static int buffer_release(struct buffer *buffer, struct drm_kms_screen *screen)
+{
+	int fence, err;
+
+	while (!done) {
+		fence = drm_kms_surface_take_release(buffer->fb);
+		if (fence >= 0) {
+			err = drm_map_import_fence(&buffer->map, DRM_MAP_READ,
+						   fence);
+			close(fence);
+
+			if (err != -ENOTTY)
+				return err;
+		}
+
+		if (buffer->fb->state == DRM_KMS_SURFACE_FREE)
+			return 0;
+
+		err = drm_kms_screen_dispatch(screen, -1);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Waits for all users of the buffer to finish with it. Page-flip events are
+ * processed in the meantime, so frames queued earlier keep being displayed.
+ * Kernels older than Linux 6.0 can't export the DMA-BUF's fences, in which
+ * case drm_map_begin() blocks until they have signaled instead.
+ */
+static int buffer_wait(struct buffer *buffer, struct drm_kms_screen *screen)
+{
+	struct pollfd fds[2];
+	int fence, err;
+
+	err = buffer_release(buffer, screen);
+	if (err < 0)
+		return err;
+
+	err = drm_map_export_fence(&buffer->map, DRM_MAP_WRITE, &fence);
+	if (err == -ENOTTY)
+		return 0;
+
+	if (err < 0)
+		return err;
+
+	while (!done) {
+		memset(fds, 0, sizeof(fds));
+		fds[0].fd = fence;
+		fds[0].events = POLLIN;
+		fds[1].fd = screen->fd;
+		fds[1].events = POLLIN;
+
+		err = poll(fds, 2, -1);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+
+			err = -errno;
+			break;
+		}
+
+		if ((fds[0].revents | fds[1].revents) &
+		    (POLLERR | POLLHUP | POLLNVAL)) {
+			err = -EIO;
+			break;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			err = drm_kms_screen_dispatch(screen, 0);
+			if (err < 0)
+				break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			err = 0;
+			break;
+		}
+	}
+
+	close(fence);
+	return err;
+}
+
+/*
+ * Cycles through several buffers, filling the next one while the display
+ * engine is still scanning out of the previous ones.
+ */
+static int run_fenced(struct drm_kms_screen *screen, struct gbm_device *gbm,
+		      int fd)
+{
+	const uint32_t colors[NUM_BUFFERS] = {
+		0xff0000ff,
+		0x0000ffff,
+		0x00ff00ff,
+	};
+	struct buffer buffers[NUM_BUFFERS];
+	unsigned int frames = 0, i;
+	int err = 0;
+
+	memset(buffers, 0, sizeof(buffers));
+
+	for (i = 0; i < NUM_BUFFERS; i++) {
+		err = buffer_init(&buffers[i], screen, gbm, fd, screen->width,
+				  screen->height);
+		if (err < 0) {
+			fprintf(stderr, "failed to create buffer: %d\n", err);
+			return err;
+		}
+	}
+
+	install_signal_handlers();
+
+	while (!done) {
+		struct buffer *buffer = &buffers[frames % NUM_BUFFERS];
+		uint32_t stride;
+		void *ptr;
+
+		err = buffer_wait(buffer, screen);
+		if (err < 0) {
+			fprintf(stderr, "failed to wait for buffer: %d\n", err);
+			break;
+		}
+
+		/* fences that could be exported have signaled already */
+		err = drm_map_begin(&buffer->map, DRM_MAP_WRITE |
+				    DRM_MAP_POPULATE, 0, 0, &ptr, &stride);
+		if (err < 0) {
+			fprintf(stderr, "failed to map DMA-BUF: %d\n", err);
+			break;
+		}
+
+		drm_pixel_fill(ptr, stride, screen->width, screen->height,
+			       colors[frames % NUM_BUFFERS]);
+
+		err = drm_map_end(&buffer->map);
+		if (err < 0) {
+			fprintf(stderr, "failed to flush buffer: %d\n", err);
+			break;
+		}
+
+		err = drm_kms_screen_flip_to(screen, buffer->fb, NULL);
+		if (err < 0) {
+			fprintf(stderr, "failed to flip screen: %d\n", err);
+			break;
+		}
+
+		frames++;
+	}
+
+	drm_kms_screen_wait_flip(screen);
+
+	for (i = 0; i < NUM_BUFFERS; i++)
+		if (buffers[i].bo)
+			buffer_fini(&buffers[i]);
+
+	return err;
+}
 
 int main(int argc, char *argv[])
 {
+	static const struct option options[] = {
+		{ "fence", 0, NULL, 'f' },
+		{ NULL, 0, NULL, 0 }
+	};
 	struct drm_kms_screen_args args;
 	struct drm_kms_screen *screen;
 	struct drm_kms_import import;
@@ -28,14 +260,26 @@ int main(int argc, char *argv[])
 	unsigned int frames = 0;
 	struct gbm_device *gbm;
 	int err, fd, prime;
+	bool fenced = false;
+	struct drm_map map;
 	struct gbm_bo *bo;
 	uint32_t handle;
+	int opt;
+
+	/* --fence waits for DMA-BUF fences in an event loop */
+	while ((opt = getopt_long(argc, argv, "f", options, NULL)) != -1) {
+		switch (opt) {
+		case 'f':
+			fenced = true;
+			break;
+		}
+	}
 
 	memset(&args, 0, sizeof(args));
 	args.flags = DRM_KMS_SCREEN_FULLSCREEN;
 	args.format = DRM_FORMAT_XRGB8888;
 
-	err = drm_kms_screen_open_with_args(&screen, argv[1], &args);
+	err = drm_kms_screen_open_with_args(&screen, argv[optind], &args);
 	if (err < 0) {
 		fprintf(stderr, "failed to open screen: %d\n", err);
 		return 1;
@@ -44,9 +288,10 @@ int main(int argc, char *argv[])
 	width = screen->width;
 	height = screen->height;
 
-	fd = open(argv[2], O_RDWR);
+	fd = open(argv[optind + 1], O_RDWR);
 	if (fd < 0) {
-		fprintf(stderr, "failed to open GBM device %s: %d\n", argv[2], errno);
+		fprintf(stderr, "failed to open GBM device %s: %d\n",
+			argv[optind + 1], errno);
 		return 1;
 	}
 
@@ -56,6 +301,12 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (fenced) {
+		err = run_fenced(screen, gbm, fd);
+		drm_kms_screen_close(screen);
+		return err < 0 ? 1 : 0;
+	}
+
 	bo = gbm_bo_create(gbm, width, height, DRM_FORMAT_XRGB8888,
 			   GBM_BO_USE_SCANOUT/* | GBM_BO_USE_LINEAR*/);
 	if (!bo) {
@@ -72,11 +323,12 @@ int main(int argc, char *argv[])
 	}
 
 	memset(&import, 0, sizeof(import));
-	import.fd = prime;
 	import.width = gbm_bo_get_width(bo);
 	import.height = gbm_bo_get_height(bo);
-	import.pitch = gbm_bo_get_stride(bo);
 	import.format = gbm_bo_get_format(bo);
+	import.planes[0].fd = prime;
+	import.planes[0].pitch = gbm_bo_get_stride(bo);
+	import.planes[0].offset = gbm_bo_get_offset(bo, 0);
 
 	err = drm_kms_screen_import_surface(screen, &fb, &import);
 	if (err < 0) {
@@ -84,58 +336,41 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	drm_map_init_dmabuf(&map, prime, width, height, gbm_bo_get_stride(bo),
+			    gbm_bo_get_offset(bo, 0));
+
+	/* keep each frame on screen for 5 seconds worth of vertical blanks */
+	err = drm_kms_screen_schedule(screen, 5 * screen->mode.vrefresh, 0);
+	if (err < 0) {
+		fprintf(stderr, "failed to schedule frames: %d\n", err);
+		return 1;
+	}
+
 	while (true) {
 		const uint32_t colors[2] = {
 			0xff0000ff,
 			0x0000ffff,
 		};
-		unsigned int i, j;
 		void *ptr;
 #if 1
-		size_t size;
-
-		size = height * gbm_bo_get_stride(bo);
-
-		if (1) {
-			struct dma_buf_sync args;
-
-			args.flags = DMA_BUF_SYNC_WRITE | DMA_BUF_SYNC_START;
-
-			err = ioctl(prime, DMA_BUF_IOCTL_SYNC, &args);
-			if (err < 0) {
-				fprintf(stderr, "failed to invalidate buffer: %d\n", errno);
-				return 1;
-			}
-		}
-
-		ptr = mmap(NULL, size, PROT_WRITE, MAP_SHARED, prime, 0);
-		if (ptr == MAP_FAILED) {
-			fprintf(stderr, "failed to mmap() DMA-BUF: %d\n", errno);
+		/* the DMA-BUF is mapped once, later frames only sync caches */
+		err = drm_map_begin(&map, DRM_MAP_WRITE | DRM_MAP_POPULATE, 0,
+				    0, &ptr, NULL);
+		if (err < 0) {
+			fprintf(stderr, "failed to map DMA-BUF: %d\n", err);
 			break;
 		}
 
-		for (j = 0; j < height; j++) {
-			uint32_t *pixels = ptr + j * gbm_bo_get_stride(bo);
-
-			for (i = 0; i < width; i++)
-				pixels[i] = colors[frames & 1];
-		}
-
-		munmap(ptr, size);
-
-		if (1) {
-			struct dma_buf_sync args;
+		drm_pixel_fill(ptr, gbm_bo_get_stride(bo), width, height,
+			       colors[frames & 1]);
 
-			args.flags = DMA_BUF_SYNC_WRITE | DMA_BUF_SYNC_END;
-
-			err = ioctl(prime, DMA_BUF_IOCTL_SYNC, &args);
-			if (err < 0) {
-				fprintf(stderr, "failed to flush buffer: %d\n", errno);
-				return 1;
-			}
+		err = drm_map_end(&map);
+		if (err < 0) {
+			fprintf(stderr, "failed to flush buffer: %d\n", err);
+			return 1;
 		}
 #else
-		unsigned int stride = 0;
+		unsigned int stride = 0, i, j;
 		void *data = NULL;
 
 		ptr = gbm_bo_map(bo, 0, 0, width, height, GBM_BO_TRANSFER_READ_WRITE, &stride, &data);
@@ -163,11 +398,17 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 
-		sleep(5);
+		err = drm_kms_screen_wait_frame(screen, NULL);
+		if (err < 0) {
+			fprintf(stderr, "failed to wait for frame: %d\n", err);
+			return 1;
+		}
+
 		break;
 		frames++;
 	}
 
+	drm_map_release(&map);
 	drm_kms_screen_close(screen);
 
 	return 0;
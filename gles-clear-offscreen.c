@@ -54,7 +54,7 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	err = drm_gpu_buffer_map(bo, &ptr, &stride);
+	err = drm_gpu_buffer_map(bo, DRM_MAP_READ, &ptr, &stride);
 	if (err < 0) {
 		fprintf(stderr, "failed to map GPU buffer: %d\n", err);
 		return 1;
@@ -15,62 +15,313 @@
 #include <GLES2/gl2.h>
 #include <EGL/egl.h>
 
+#include "common.h"
 #include "drm-kms.h"
 #include "drm-gpu.h"
 
+/* drop the cached framebuffer once GBM destroys the buffer behind it */
+static void evict_buffer(struct drm_gpu_buffer *bo, void *data)
+{
+	drm_kms_screen_evict_import(data, bo->planes[0].fd);
+}
+
+static const GLchar *upscale_vs[] = {
+	"attribute vec4 position;\n",
+	"attribute vec2 texcoord;\n",
+	"varying vec2 uv;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"  gl_Position = position;\n",
+	"  uv = texcoord;\n",
+	"}\n",
+};
+
+static const GLchar *upscale_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D tex;\n",
+	"varying vec2 uv;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"  gl_FragColor = texture2D(tex, uv);\n",
+	"}\n",
+};
+
+static GLuint upscale_program_create(void)
+{
+	GLuint vs, fs, program;
+
+	vs = glsl_shader_load(GL_VERTEX_SHADER, upscale_vs,
+			      ARRAY_SIZE(upscale_vs));
+	fs = glsl_shader_load(GL_FRAGMENT_SHADER, upscale_fs,
+			      ARRAY_SIZE(upscale_fs));
+	if (!vs || !fs)
+		return 0;
+
+	program = glsl_program_create(vs, fs);
+	if (!program)
+		return 0;
+
+	glBindAttribLocation(program, 0, "position");
+	glBindAttribLocation(program, 1, "texcoord");
+	glsl_program_link(program);
+
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+
+	return program;
+}
+
+/* clears the part of a rectangle that lies within the scissor rectangle */
+static void clear_rect(const struct drm_gpu_rect *rect,
+		       const struct drm_gpu_rect *scissor, const float *color)
+{
+	int x0 = rect->x > scissor->x ? rect->x : scissor->x;
+	int y0 = rect->y > scissor->y ? rect->y : scissor->y;
+	int x1 = rect->x + rect->width, y1 = rect->y + rect->height;
+
+	if (x1 > scissor->x + (int)scissor->width)
+		x1 = scissor->x + scissor->width;
+
+	if (y1 > scissor->y + (int)scissor->height)
+		y1 = scissor->y + scissor->height;
+
+	if (x1 <= x0 || y1 <= y0)
+		return;
+
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(x0, y0, x1 - x0, y1 - y0);
+	glClearColor(color[0], color[1], color[2], color[3]);
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+/* stretches the render-sized framebuffer over the whole window surface */
+static void upscale(GLuint program, struct framebuffer *framebuffer,
+		    unsigned int width, unsigned int height)
+{
+	static const GLfloat vertices[] = {
+		-1.0f, -1.0f, 0.0f, 0.0f,
+		 1.0f, -1.0f, 1.0f, 0.0f,
+		-1.0f,  1.0f, 0.0f, 1.0f,
+		 1.0f,  1.0f, 1.0f, 1.0f,
+	};
+
+	framebuffer_bind(NULL);
+	glViewport(0, 0, width, height);
+
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, framebuffer->texture);
+	glUniform1i(glGetUniformLocation(program, "tex"), 0);
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      &vertices[0]);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      &vertices[2]);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
 int main(int argc, char *argv[])
 {
+	struct drm_kms_surface *fb, *prev_fb = NULL;
+	struct drm_gpu_buffer *bo, *prev_bo = NULL;
+	struct framebuffer *framebuffer = NULL;
+	struct gles_options options;
 	struct drm_kms_screen_args args;
 	struct drm_gpu_surface *surface;
 	struct drm_kms_screen *screen;
 	struct drm_kms_import import;
 	unsigned int width, height;
-	struct drm_kms_surface *fb;
-	struct drm_gpu_buffer *bo;
-	unsigned int frames = 0;
+	unsigned int num_modifiers;
+	uint64_t *modifiers;
+	unsigned int frames = 0, i;
+	bool scheduled = false;
+	GLuint program = 0;
 	struct drm_gpu *gpu;
-	int err;
+	int err, index;
+	int release = -1;
+	bool fences;
+	struct drm_gpu_rect square, redraw;
+
+	/*
+	 * --size selects a render size smaller than the mode, --partial only
+	 * blinks a square in the middle of the screen and redraws as little
+	 * as the buffer age allows.
+	 */
+	memset(&options, 0, sizeof(options));
+
+	index = gles_parse_command_line(&options, argc, argv);
+	if (index < 0)
+		return 1;
 
 	memset(&args, 0, sizeof(args));
-	args.flags = DRM_KMS_SCREEN_FULLSCREEN;
+	args.flags = DRM_KMS_SCREEN_FULLSCREEN | DRM_KMS_SCREEN_STATS;
 	args.format = DRM_FORMAT_XRGB8888;
+	args.render_width = options.width;
+	args.render_height = options.height;
 
-	err = drm_kms_screen_open_with_args(&screen, argv[1], &args);
+	err = drm_kms_screen_open_with_args(&screen, argv[index], &args);
 	if (err < 0) {
 		fprintf(stderr, "failed to open screen: %d\n", err);
 		return 1;
 	}
 
-	width = screen->width;
-	height = screen->height;
+	width = screen->render.width;
+	height = screen->render.height;
 
-	err = drm_gpu_open(&gpu, argv[2]);
+	err = drm_gpu_open(&gpu, argv[index + 1]);
 	if (err < 0) {
 		fprintf(stderr, "failed to open GPU: %d\n", err);
 		return 1;
 	}
 
-	err = drm_gpu_surface_create(&surface, gpu, width, height,
-				     DRM_FORMAT_XRGB8888,
-				     DRM_GPU_SCANOUT | DRM_GPU_RENDER);
+	/* let the GPU pick a tiled or compressed layout that can be scanned out */
+	err = drm_kms_screen_get_modifiers(screen, DRM_FORMAT_XRGB8888,
+					   &modifiers, &num_modifiers);
+	if (err < 0) {
+		fprintf(stderr, "failed to get modifiers: %d\n", err);
+		return 1;
+	}
+
+	err = drm_gpu_surface_create_with_modifiers(&surface, gpu,
+						    screen->width,
+						    screen->height,
+						    DRM_FORMAT_XRGB8888,
+						    modifiers, num_modifiers,
+						    DRM_GPU_SCANOUT |
+						    DRM_GPU_RENDER);
+	free(modifiers);
+
 	if (err < 0) {
 		fprintf(stderr, "failed to create GPU surface: %d\n", err);
 		return 1;
 	}
 
+	surface->destroy = evict_buffer;
+	surface->destroy_data = screen;
+
 	drm_gpu_bind_surface(gpu, surface);
 
-	while (true) {
+	/*
+	 * If the display engine can't scale, render into an offscreen buffer
+	 * at the requested size and stretch that to the screen on the GPU.
+	 */
+	if (width != screen->width || height != screen->height) {
+		framebuffer = framebuffer_create(width, height, GL_RGBA);
+		if (!framebuffer) {
+			fprintf(stderr, "failed to create framebuffer\n");
+			return 1;
+		}
+
+		program = upscale_program_create();
+		if (!program) {
+			fprintf(stderr, "failed to create upscale program\n");
+			return 1;
+		}
+	}
+
+	printf("rendering at %ux%u, scanning out at %ux%u (%s scaling)\n",
+	       width, height, screen->mode.hdisplay, screen->mode.vdisplay,
+	       screen->render.scaled ? "plane" : framebuffer ? "GPU" : "no");
+
+	/*
+	 * With explicit fences the display engine waits for rendering to
+	 * complete rather than the CPU, and the GPU waits for the display
+	 * engine to release the buffers it renders into.
+	 */
+	fences = drm_gpu_has_fences(gpu);
+	printf("synchronization: %s\n", fences ? "explicit" : "implicit");
+
+	/* the upscale pass redraws the whole surface every frame */
+	if (options.partial && framebuffer) {
+		fprintf(stderr, "partial updates require rendering at screen size\n");
+		options.partial = false;
+	}
+
+	square.width = screen->width / 8;
+	square.height = screen->height / 8;
+	square.x = (screen->width - square.width) / 2;
+	square.y = (screen->height - square.height) / 2;
+
+	/* start rendering 2 ms before each vertical blank */
+	err = drm_kms_screen_schedule(screen, 1, 2000);
+	if (err < 0)
+		fprintf(stderr, "vertical blank scheduling not available: %d\n", err);
+	else
+		scheduled = true;
+
+	install_signal_handlers();
+
+	while (!done) {
 		const float colors[2][4] = {
 			{ 1.0, 0.0, 0.0, 1.0 },
 			{ 0.0, 0.0, 1.0, 1.0 },
 		};
 		const float *color = colors[frames & 1];
+		int fence = -1;
+
+		if (scheduled) {
+			err = drm_kms_screen_wait_frame(screen, NULL);
+			if (err < 0) {
+				fprintf(stderr, "failed to wait for frame: %d\n", err);
+				return 1;
+			}
+		}
+
+		/* GBM may hand out the buffer that was last scanned out */
+		if (release >= 0) {
+			err = drm_gpu_wait_fence(gpu, release);
+			if (err < 0)
+				fprintf(stderr, "failed to wait for release fence: %d\n", err);
+
+			release = -1;
+		}
+
+		if (options.partial) {
+			const float background[4] = { 0.25, 0.25, 0.25, 1.0 };
+
+			/* only the square changes after the first frame */
+			drm_gpu_surface_begin(surface, frames ? &square : NULL,
+					      &redraw);
+
+			glViewport(0, 0, width, height);
+			glClearColor(background[0], background[1],
+				     background[2], background[3]);
+			glClear(GL_COLOR_BUFFER_BIT);
+			clear_rect(&square, &redraw, color);
+		} else {
+			drm_gpu_surface_begin(surface, NULL, &redraw);
+
+			/* the offscreen buffer is cleared in full as well */
+			if (framebuffer) {
+				framebuffer_bind(framebuffer);
+				drm_gpu_invalidate(gpu, DRM_GPU_COLOR);
+			}
+
+			glViewport(0, 0, width, height);
+			glClearColor(color[0], color[1], color[2], color[3]);
+			glClear(GL_COLOR_BUFFER_BIT);
+
+			if (framebuffer)
+				upscale(program, framebuffer, screen->width,
+					screen->height);
+		}
+
+		if (fences) {
+			err = drm_gpu_create_fence(gpu, &fence);
+			if (err < 0)
+				fprintf(stderr, "failed to create fence: %d\n", err);
+		}
 
-		glViewport(0, 0, width, height);
-		glClearColor(color[0], color[1], color[2], color[3]);
-		glClear(GL_COLOR_BUFFER_BIT);
-		eglSwapBuffers(gpu->egl.display, surface->egl.surface);
+		err = drm_gpu_surface_swap(surface);
+		if (err < 0) {
+			fprintf(stderr, "failed to swap buffers: %d\n", err);
+			return 1;
+		}
 
 		err = drm_gpu_surface_lock(surface, &bo);
 		if (err < 0) {
@@ -79,11 +330,17 @@ int main(int argc, char *argv[])
 		}
 
 		memset(&import, 0, sizeof(import));
-		import.fd = bo->fd;
 		import.width = bo->width;
 		import.height = bo->height;
-		import.pitch = bo->stride;
 		import.format = bo->format;
+		import.num_planes = bo->num_planes;
+
+		for (i = 0; i < bo->num_planes; i++) {
+			import.planes[i].fd = bo->planes[i].fd;
+			import.planes[i].offset = bo->planes[i].offset;
+			import.planes[i].pitch = bo->planes[i].stride;
+			import.planes[i].modifier = bo->modifier;
+		}
 
 		err = drm_kms_screen_import_surface(screen, &fb, &import);
 		if (err < 0) {
@@ -91,20 +348,72 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 
-		drm_gpu_surface_unlock(surface, bo);
+		if (fence >= 0)
+			drm_kms_surface_set_fence(fb, fence);
 
-		err = drm_kms_screen_swap_to(screen, fb);
+		err = drm_kms_screen_flip_to(screen, fb, NULL);
 		if (err < 0) {
-			fprintf(stderr, "failed to swap screen: %d\n", err);
+			fprintf(stderr, "failed to flip screen: %d\n", err);
 			return 1;
 		}
 
-		sleep(1);
+		/*
+		 * If the flip was committed with an out-fence, the previous
+		 * buffer can be given back right away. Otherwise wait until
+		 * it is no longer being scanned out.
+		 */
+		if (prev_fb)
+			release = drm_kms_surface_take_release(prev_fb);
+
+		if (release < 0) {
+			err = drm_kms_screen_wait_flip(screen);
+			if (err < 0) {
+				fprintf(stderr, "failed to wait for flip: %d\n", err);
+				return 1;
+			}
+		}
+
+		if (prev_bo) {
+			drm_kms_surface_free(prev_fb);
+			drm_gpu_surface_unlock(surface, prev_bo);
+		}
+
+		prev_fb = fb;
+		prev_bo = bo;
 		frames++;
 	}
 
-	drm_gpu_close(gpu);
+	drm_kms_screen_print_stats(screen, stdout);
+
+	if (argc > index + 2) {
+		err = drm_kms_screen_save_stats(screen, argv[index + 2]);
+		if (err < 0)
+			fprintf(stderr, "failed to save statistics: %d\n", err);
+	}
+
+	if (framebuffer) {
+		glDeleteProgram(program);
+		framebuffer_free(framebuffer);
+	}
+
+	if (release >= 0)
+		close(release);
+
+	if (prev_bo) {
+		drm_kms_surface_free(prev_fb);
+		drm_gpu_surface_unlock(surface, prev_bo);
+	}
+
+	/*
+	 * The last frame is still on screen. Restore the original CRTC
+	 * configuration before the buffers behind the framebuffers go away,
+	 * which the screen no longer needs to be told about.
+	 */
 	drm_kms_screen_close(screen);
+	surface->destroy = NULL;
+
+	drm_gpu_surface_free(surface);
+	drm_gpu_close(gpu);
 
 	return 0;
 }
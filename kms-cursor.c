@@ -0,0 +1,134 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+
+#include "common.h"
+#include "drm-kms.h"
+
+#define CURSOR_SIZE 32
+
+/* white arrow with a black outline, hotspot at the tip */
+static void draw_arrow(uint32_t *image, unsigned int size)
+{
+	unsigned int x, y;
+
+	for (y = 0; y < size; y++) {
+		for (x = 0; x < size; x++) {
+			uint32_t *pixel = &image[y * size + x];
+
+			if (x > y || x + y / 2 >= size)
+				*pixel = 0x00000000;
+			else if (x == 0 || x == y || x + y / 2 == size - 1)
+				*pixel = 0xff000000;
+			else
+				*pixel = 0xffffffff;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t image[CURSOR_SIZE * CURSOR_SIZE];
+	struct drm_kms_screen_args args;
+	struct drm_kms_cursor *cursor;
+	struct drm_kms_screen *screen;
+	struct drm_kms_surface *fb;
+	unsigned int frames = 0;
+	bool scheduled = false;
+	void *buffer;
+	int fd, err;
+
+	fd = open(argv[1], O_RDWR);
+	if (fd < 0)
+		return 1;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = DRM_KMS_SCREEN_FULLSCREEN;
+	args.format = DRM_FORMAT_XRGB8888;
+
+	err = drm_kms_screen_create_with_args(&screen, fd, &args);
+	if (err < 0) {
+		fprintf(stderr, "failed to create KMS screen: %d\n", err);
+		return 1;
+	}
+
+	/* the frame is drawn only once, only the cursor moves afterwards */
+	err = drm_kms_screen_acquire(screen, &fb);
+	if (err < 0)
+		goto free;
+
+	err = drm_kms_surface_lock(fb, &buffer);
+	if (err < 0)
+		goto free;
+
+	memset(buffer, 0x40, fb->bo->size);
+	drm_kms_surface_unlock(fb);
+
+	err = drm_kms_screen_flip(screen, NULL);
+	if (err < 0) {
+		fprintf(stderr, "failed to flip screen: %d\n", err);
+		goto free;
+	}
+
+	draw_arrow(image, CURSOR_SIZE);
+
+	err = drm_kms_cursor_create(&cursor, screen, image, CURSOR_SIZE,
+				    CURSOR_SIZE, 0, 0);
+	if (err < 0) {
+		fprintf(stderr, "failed to create cursor: %d\n", err);
+		goto free;
+	}
+
+	drm_kms_cursor_move(cursor, screen->width / 2, screen->height / 2);
+
+	err = drm_kms_cursor_show(cursor);
+	if (err < 0) {
+		fprintf(stderr, "failed to show cursor: %d\n", err);
+		goto cursor;
+	}
+
+	err = drm_kms_screen_schedule(screen, 1, 0);
+	if (err < 0)
+		fprintf(stderr, "vertical blank scheduling not available: %d\n", err);
+	else
+		scheduled = true;
+
+	install_signal_handlers();
+
+	while (!done) {
+		double angle = frames++ * M_PI / 120.0;
+		int x, y;
+
+		if (scheduled) {
+			err = drm_kms_screen_wait_frame(screen, NULL);
+			if (err < 0)
+				break;
+		} else {
+			usleep(16667);
+		}
+
+		x = screen->width / 2 + cos(angle) * screen->width / 4;
+		y = screen->height / 2 + sin(angle) * screen->height / 4;
+
+		err = drm_kms_cursor_move(cursor, x, y);
+		if (err < 0) {
+			fprintf(stderr, "failed to move cursor: %d\n", err);
+			break;
+		}
+	}
+
+	printf("moved cursor %u times\n", frames);
+
+cursor:
+	drm_kms_cursor_free(cursor);
+free:
+	drm_kms_screen_free(screen);
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+
+#include "common.h"
+#include "drm-kms.h"
+
+#define SQUARE_SIZE 64
+
+static void fill_rect(struct drm_kms_surface *fb, void *buffer,
+		      const struct drm_kms_rect *rect, uint32_t color)
+{
+	unsigned int x, y;
+
+	for (y = 0; y < rect->height; y++) {
+		uint32_t *pixels = buffer + (rect->y + y) * fb->bo->pitch;
+
+		for (x = 0; x < rect->width; x++)
+			pixels[rect->x + x] = color;
+	}
+}
+
+/*
+ * Bounces a square across a single framebuffer that stays on screen. Only
+ * the square's old and new positions are redrawn and marked as damaged, so
+ * displays that copy or compose the framebuffer only need to update those.
+ * Drawing goes to a cached shadow buffer, and only the same rectangles are
+ * copied to the framebuffer.
+ */
+int main(int argc, char *argv[])
+{
+	struct drm_kms_screen_args args;
+	struct drm_kms_screen *screen;
+	struct drm_kms_rect damage[2];
+	struct drm_kms_surface *fb;
+	unsigned int frames = 0;
+	int dx = 4, dy = 4;
+	void *buffer;
+	int fd, err;
+
+	fd = open(argv[1], O_RDWR);
+	if (fd < 0)
+		return 1;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = DRM_KMS_SCREEN_FULLSCREEN | DRM_KMS_SCREEN_STATS |
+		     DRM_KMS_SCREEN_SHADOW;
+	args.format = DRM_FORMAT_XRGB8888;
+
+	err = drm_kms_screen_create_with_args(&screen, fd, &args);
+	if (err < 0) {
+		fprintf(stderr, "failed to create KMS screen: %d\n", err);
+		return 1;
+	}
+
+	err = drm_kms_screen_acquire(screen, &fb);
+	if (err < 0)
+		goto free;
+
+	err = drm_kms_surface_lock(fb, &buffer);
+	if (err < 0)
+		goto free;
+
+	memset(buffer, 0x40, fb->bo->size);
+
+	damage[1].x = 0;
+	damage[1].y = 0;
+	damage[1].width = SQUARE_SIZE;
+	damage[1].height = SQUARE_SIZE;
+
+	fill_rect(fb, buffer, &damage[1], 0xffffffff);
+	drm_kms_surface_unlock(fb);
+
+	err = drm_kms_screen_flip_to(screen, fb, NULL);
+	if (err < 0) {
+		fprintf(stderr, "failed to flip screen: %d\n", err);
+		goto free;
+	}
+
+	install_signal_handlers();
+
+	while (!done) {
+		err = drm_kms_screen_wait_flip(screen);
+		if (err < 0)
+			break;
+
+		damage[0] = damage[1];
+
+		if (damage[1].x + dx < 0 ||
+		    damage[1].x + dx + SQUARE_SIZE > fb->width)
+			dx = -dx;
+
+		if (damage[1].y + dy < 0 ||
+		    damage[1].y + dy + SQUARE_SIZE > fb->height)
+			dy = -dy;
+
+		damage[1].x += dx;
+		damage[1].y += dy;
+
+		err = drm_kms_surface_lock(fb, &buffer);
+		if (err < 0)
+			break;
+
+		fill_rect(fb, buffer, &damage[0], 0x40404040);
+		fill_rect(fb, buffer, &damage[1], 0xffffffff);
+
+		/* with damage set, unlocking only copies it from the shadow */
+		err = drm_kms_surface_set_damage(fb, damage, 2);
+		if (err < 0)
+			break;
+
+		drm_kms_surface_unlock(fb);
+
+		err = drm_kms_screen_flip_to(screen, fb, NULL);
+		if (err < 0) {
+			fprintf(stderr, "failed to flip screen: %d\n", err);
+			break;
+		}
+
+		/* without page-flip events, pace updates to roughly 60 Hz */
+		if (!screen->pending)
+			usleep(16667);
+
+		frames++;
+	}
+
+	printf("updated %u frames\n", frames);
+	drm_kms_screen_print_stats(screen, stdout);
+
+free:
+	drm_kms_screen_free(screen);
+
+	close(fd);
+
+	return 0;
+}
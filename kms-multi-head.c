@@ -0,0 +1,118 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+
+#include "common.h"
+#include "drm-kms.h"
+
+int main(int argc, char *argv[])
+{
+	struct drm_kms_screen_args args;
+	struct drm_kms_display *display;
+	unsigned int *frames, i;
+	bool pool = false;
+	int err;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = DRM_KMS_SCREEN_FULLSCREEN | DRM_KMS_SCREEN_STATS;
+	args.format = DRM_FORMAT_XRGB8888;
+
+	for (i = 2; i < argc; i++) {
+		/* scan out a single buffer across all outputs */
+		if (strcmp(argv[i], "span") == 0)
+			args.flags |= DRM_KMS_SCREEN_SPAN;
+
+		/* render each frame into a new surface, recycled by the pool */
+		if (strcmp(argv[i], "pool") == 0) {
+			args.pool_size = 64 << 20;
+			pool = true;
+		}
+	}
+
+	err = drm_kms_display_open(&display, argv[1], &args);
+	if (err < 0) {
+		fprintf(stderr, "failed to open display: %d\n", err);
+		return 1;
+	}
+
+	printf("driving %u outputs\n", display->num_screens);
+
+	frames = calloc(display->num_screens, sizeof(*frames));
+	if (!frames)
+		return 1;
+
+	install_signal_handlers();
+
+	while (!done) {
+		for (i = 0; i < display->num_screens; i++) {
+			struct drm_kms_screen *screen = display->screens[i];
+			struct drm_kms_surface *fb;
+			void *buffer;
+
+			/* skip outputs that are still busy with a flip */
+			if (pool) {
+				if (screen->pending)
+					continue;
+
+				err = drm_kms_surface_create(&fb, screen,
+							     screen->width,
+							     screen->height,
+							     DRM_FORMAT_XRGB8888);
+			} else {
+				err = drm_kms_screen_try_acquire(screen, &fb);
+				if (err == -EAGAIN)
+					continue;
+			}
+
+			if (err < 0)
+				break;
+
+			err = drm_kms_surface_lock(fb, &buffer);
+			if (err < 0)
+				break;
+
+			memset(buffer, (frames[i] & 1) ? 0x00 : 0xff,
+			       fb->bo->size);
+			drm_kms_surface_unlock(fb);
+
+			if (pool) {
+				err = drm_kms_screen_flip_to(screen, fb, NULL);
+
+				/* released once the next frame replaces it */
+				drm_kms_surface_free(fb);
+			} else {
+				err = drm_kms_screen_flip(screen, NULL);
+			}
+
+			if (err < 0) {
+				fprintf(stderr, "failed to flip output %u: %d\n",
+					i, err);
+				break;
+			}
+
+			frames[i]++;
+		}
+
+		if (err < 0 && err != -EAGAIN)
+			break;
+
+		err = drm_kms_display_dispatch(display, -1);
+		if (err < 0)
+			break;
+	}
+
+	for (i = 0; i < display->num_screens; i++) {
+		printf("output %u:\n", i);
+		drm_kms_screen_print_stats(display->screens[i], stdout);
+	}
+
+	drm_kms_display_close(display);
+	free(frames);
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "drm-kms.h"
+#include "drm-pixel.h"
+
+#define WIDTH 3840
+#define HEIGHT 2160
+#define ITERATIONS 50
+
+/* an odd-sized window at an unaligned offset, like a damaged region */
+#define RECT_X 3
+#define RECT_Y 5
+#define RECT_WIDTH 1366
+#define RECT_HEIGHT 768
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *kernels, const char *test, uint64_t bytes,
+		   uint64_t duration)
+{
+	printf("  %-8s %-10s %8.2f GB/s\n", kernels, test,
+	       (double)bytes / duration);
+}
+
+/*
+ * Measures the throughput of the pixel kernels. If a DRM device is given,
+ * the destination is a (usually write-combined) dumb buffer, otherwise it
+ * is regular cached memory.
+ */
+int main(int argc, char *argv[])
+{
+	const struct drm_pixel_kernels *kernels;
+	struct drm_kms_bo *bo = NULL;
+	uint32_t pitch, src_pitch;
+	unsigned int i, j;
+	uint64_t start;
+	void *dst, *src;
+	int fd = -1, err;
+
+	if (argc > 1) {
+		fd = open(argv[1], O_RDWR);
+		if (fd < 0) {
+			fprintf(stderr, "failed to open %s: %d\n", argv[1], errno);
+			return 1;
+		}
+
+		err = drm_kms_bo_create(&bo, fd, WIDTH, HEIGHT, 32);
+		if (err < 0) {
+			fprintf(stderr, "failed to create dumb buffer: %d\n", err);
+			return 1;
+		}
+
+		err = drm_kms_bo_map(bo);
+		if (err < 0) {
+			fprintf(stderr, "failed to map dumb buffer: %d\n", err);
+			return 1;
+		}
+
+		dst = bo->ptr;
+		pitch = bo->pitch;
+	} else {
+		pitch = WIDTH * 4;
+
+		dst = aligned_alloc(64, (size_t)pitch * HEIGHT);
+		if (!dst)
+			return 1;
+	}
+
+	/* the source rows are padded so that pitches differ */
+	src_pitch = WIDTH * 4 + 64;
+
+	src = aligned_alloc(64, (size_t)src_pitch * HEIGHT);
+	if (!src)
+		return 1;
+
+	memset(src, 0x55, (size_t)src_pitch * HEIGHT);
+
+	printf("%ux%u, pitch %u bytes, %s memory\n", WIDTH, HEIGHT, pitch,
+	       bo ? "dumb buffer" : "system");
+
+	for (i = 0; (kernels = drm_pixel_enumerate(i)) != NULL; i++) {
+		drm_pixel_set_kernels(kernels);
+
+		start = get_time();
+
+		for (j = 0; j < ITERATIONS; j++)
+			drm_pixel_fill(dst, pitch, WIDTH, HEIGHT, 0xff000000 | j);
+
+		report(kernels->name, "fill",
+		       (uint64_t)WIDTH * HEIGHT * 4 * ITERATIONS,
+		       get_time() - start);
+
+		start = get_time();
+
+		for (j = 0; j < ITERATIONS; j++)
+			drm_pixel_copy(dst, src, (size_t)pitch * HEIGHT);
+
+		report(kernels->name, "copy",
+		       (uint64_t)pitch * HEIGHT * ITERATIONS,
+		       get_time() - start);
+
+		start = get_time();
+
+		for (j = 0; j < ITERATIONS; j++)
+			drm_pixel_copy_rect(dst + RECT_Y * pitch + RECT_X * 4,
+					    pitch,
+					    src + RECT_Y * src_pitch + RECT_X * 4,
+					    src_pitch, RECT_WIDTH * 4,
+					    RECT_HEIGHT);
+
+		report(kernels->name, "copy-rect",
+		       (uint64_t)RECT_WIDTH * RECT_HEIGHT * 4 * ITERATIONS,
+		       get_time() - start);
+	}
+
+	free(src);
+
+	if (bo) {
+		drm_kms_bo_unmap(bo);
+		drm_kms_bo_free(bo);
+		close(fd);
+	} else {
+		free(dst);
+	}
+
+	return 0;
+}
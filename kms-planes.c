@@ -0,0 +1,219 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+
+#include "common.h"
+#include "drm-kms.h"
+
+static void print_plane(const struct drm_kms_plane *plane)
+{
+	unsigned int i;
+
+	printf("plane %u: zpos %llu (%llu-%llu%s), formats:", plane->id,
+	       (unsigned long long)plane->zpos,
+	       (unsigned long long)plane->zpos_min,
+	       (unsigned long long)plane->zpos_max,
+	       plane->zpos_mutable ? "" : ", immutable");
+
+	for (i = 0; i < plane->num_formats; i++)
+		printf(" %.4s", (const char *)&plane->formats[i]);
+
+	printf("\n");
+}
+
+/*
+ * Exports an NV12 dumb buffer and imports both of its planes from the one
+ * DMA-BUF, the same way that frames from a video decoder are imported.
+ */
+static int create_nv12_overlay(struct drm_kms_screen *screen,
+			       unsigned int width, unsigned int height,
+			       struct drm_kms_bo **bop,
+			       struct drm_kms_surface **surfacep)
+{
+	struct drm_kms_import import;
+	struct drm_kms_bo *bo;
+	int err, fd;
+
+	/* luma plane followed by the half-height, interleaved chroma plane */
+	err = drm_kms_bo_create(&bo, screen->fd, width, height * 3 / 2, 8);
+	if (err < 0)
+		return err;
+
+	err = drm_kms_bo_map(bo);
+	if (err < 0)
+		goto free;
+
+	memset(bo->ptr, 0x80, bo->pitch * height);
+	memset(bo->ptr + bo->pitch * height, 0x40, bo->pitch * height / 2);
+	drm_kms_bo_unmap(bo);
+
+	err = drmPrimeHandleToFD(screen->fd, bo->handle, DRM_CLOEXEC, &fd);
+	if (err < 0) {
+		err = -errno;
+		goto free;
+	}
+
+	memset(&import, 0, sizeof(import));
+	import.width = width;
+	import.height = height;
+	import.format = DRM_FORMAT_NV12;
+	import.planes[0].fd = fd;
+	import.planes[0].pitch = bo->pitch;
+	import.planes[1].fd = fd;
+	import.planes[1].offset = bo->pitch * height;
+	import.planes[1].pitch = bo->pitch;
+
+	err = drm_kms_screen_import_surface(screen, surfacep, &import);
+	close(fd);
+
+	if (err < 0)
+		goto free;
+
+	*bop = bo;
+
+	return 0;
+
+free:
+	drm_kms_bo_free(bo);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct drm_kms_surface *overlay = NULL;
+	struct drm_kms_bo *nv12 = NULL;
+	struct drm_kms_screen_args args;
+	struct drm_kms_screen *screen;
+	struct drm_kms_plane *plane = NULL;
+	uint32_t format = DRM_FORMAT_XRGB8888;
+	unsigned int width, height, i, frame = 0;
+	struct drm_kms_rect dst;
+	void *buffer;
+	int fd, err;
+
+	fd = open(argv[1], O_RDWR);
+	if (fd < 0)
+		return 1;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = DRM_KMS_SCREEN_FULLSCREEN;
+	args.format = DRM_FORMAT_XRGB8888;
+
+	err = drm_kms_screen_create_with_args(&screen, fd, &args);
+	if (err < 0) {
+		fprintf(stderr, "failed to create KMS screen: %d\n", err);
+		return 1;
+	}
+
+	err = drm_kms_screen_enumerate_planes(screen);
+	if (err < 0) {
+		fprintf(stderr, "failed to enumerate planes: %d\n", err);
+		goto free;
+	}
+
+	for (i = 0; i < screen->num_planes; i++)
+		print_plane(&screen->planes[i]);
+
+	/* prefer scanning out YUV directly, as for decoded video */
+	for (i = 0; i < screen->num_planes; i++) {
+		if (drm_kms_plane_supports_format(&screen->planes[i],
+						  DRM_FORMAT_NV12)) {
+			plane = &screen->planes[i];
+			format = DRM_FORMAT_NV12;
+			break;
+		}
+
+		if (!plane && drm_kms_plane_supports_format(&screen->planes[i],
+							   DRM_FORMAT_XRGB8888))
+			plane = &screen->planes[i];
+	}
+
+	if (!plane) {
+		fprintf(stderr, "no overlay plane supports NV12 or XRGB8888\n");
+		goto free;
+	}
+
+	width = (screen->width / 2) & ~1;
+	height = (screen->height / 2) & ~1;
+
+	if (format == DRM_FORMAT_NV12) {
+		err = create_nv12_overlay(screen, width, height, &nv12,
+					  &overlay);
+		if (err < 0) {
+			fprintf(stderr, "failed to import NV12 overlay: %d\n",
+				err);
+			goto free;
+		}
+	} else {
+		err = drm_kms_surface_create(&overlay, screen, width, height,
+					     format);
+		if (err < 0) {
+			fprintf(stderr, "failed to create overlay surface: %d\n", err);
+			goto free;
+		}
+
+		err = drm_kms_surface_lock(overlay, &buffer);
+		if (err < 0)
+			goto free;
+
+		memset(buffer, 0x80, overlay->bo->size);
+		drm_kms_surface_unlock(overlay);
+	}
+
+	/* center the overlay, scaling nothing */
+	dst.x = screen->width / 4;
+	dst.y = screen->height / 4;
+	dst.width = overlay->width;
+	dst.height = overlay->height;
+
+	err = drm_kms_plane_attach(plane, overlay, NULL, &dst, -1);
+	if (err < 0) {
+		fprintf(stderr, "failed to attach plane %u: %d\n", plane->id,
+			err);
+		goto free;
+	}
+
+	install_signal_handlers();
+
+	/* the overlay stays put while the primary plane is flipped */
+	while (!done) {
+		int color = (frame++ & 1) ? 0x00 : 0xff;
+		struct drm_kms_surface *fb;
+
+		err = drm_kms_screen_acquire(screen, &fb);
+		if (err < 0)
+			break;
+
+		err = drm_kms_surface_lock(fb, &buffer);
+		if (err < 0)
+			break;
+
+		memset(buffer, color, fb->bo->size);
+		drm_kms_surface_unlock(fb);
+
+		err = drm_kms_screen_flip(screen, NULL);
+		if (err < 0) {
+			fprintf(stderr, "failed to flip screen: %d\n", err);
+			break;
+		}
+	}
+
+	drm_kms_plane_detach(plane);
+	drm_kms_screen_update_planes(screen);
+
+free:
+	if (overlay)
+		drm_kms_surface_free(overlay);
+
+	if (nv12)
+		drm_kms_bo_free(nv12);
+
+	drm_kms_screen_free(screen);
+
+	close(fd);
+
+	return 0;
+}
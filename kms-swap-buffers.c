@@ -4,7 +4,9 @@
 
 #include <drm_fourcc.h>
 
+#include "common.h"
 #include "drm-kms.h"
+#include "drm-pixel.h"
 
 int main(int argc, char *argv[])
 {
@@ -18,8 +20,10 @@ int main(int argc, char *argv[])
 		return 1;
 
 	memset(&args, 0, sizeof(args));
-	args.flags = DRM_KMS_SCREEN_FULLSCREEN;
+	args.flags = DRM_KMS_SCREEN_FULLSCREEN | DRM_KMS_SCREEN_STATS;
 	args.format = DRM_FORMAT_XRGB8888;
+	args.num_buffers = 3;
+	args.present_mode = DRM_KMS_PRESENT_MODE_MAILBOX;
 
 	err = drm_kms_screen_create_with_args(&screen, fd, &args);
 	if (err < 0) {
@@ -27,23 +31,42 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	while (1) {
-		struct drm_kms_surface *fb = screen->fb[current];
-		int color = current ? 0x00 : 0xff;
+	install_signal_handlers();
+
+	while (!done) {
+		uint32_t color = current ? 0x00000000 : 0xffffffff;
+		struct drm_kms_surface *fb;
 		void *buffer;
 
+		err = drm_kms_screen_acquire(screen, &fb);
+		if (err < 0)
+			break;
+
 		err = drm_kms_surface_lock(fb, &buffer);
 		if (err < 0)
 			break;
 
-		memset(buffer, color, fb->bo->size);
+		drm_pixel_fill(buffer, fb->bo->pitch, fb->width, fb->height,
+			       color);
 		drm_kms_surface_unlock(fb);
 
-		drm_kms_screen_swap(screen);
+		err = drm_kms_screen_flip(screen, NULL);
+		if (err < 0) {
+			fprintf(stderr, "failed to flip screen: %d\n", err);
+			break;
+		}
 
 		current ^= 1;
 	}
 
+	drm_kms_screen_print_stats(screen, stdout);
+
+	if (argc > 2) {
+		err = drm_kms_screen_save_stats(screen, argv[2]);
+		if (err < 0)
+			fprintf(stderr, "failed to save statistics: %d\n", err);
+	}
+
 	drm_kms_screen_free(screen);
 
 	close(fd);